@@ -0,0 +1,293 @@
+#include "stdafx.h"
+#include "BlockCompression.h"
+#include "TaskPool.h"
+#include <cfloat>
+#include <cmath>
+#include <limits>
+
+namespace BlockCompression
+{
+
+// Texels of one block as R, G, B
+typedef float BlockTexels[16][3];
+
+// 5:6:5 with red in the high bits, rounded to the nearest representable color
+static UINT16 PackRgb565(float const color[3])
+{
+	UINT r = static_cast<UINT>(min(max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+	UINT g = static_cast<UINT>(min(max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+	UINT b = static_cast<UINT>(min(max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+	return static_cast<UINT16>((r << 11) | (g << 5) | b);
+}
+
+static void UnpackRgb565(UINT16 color, int rgb[3])
+{
+	int r = color >> 11;
+	int g = (color >> 5) & 0x3F;
+	int b = color & 0x1F;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+// The colors a block's indices select. color0 > color1 is the four color mode the encoder uses. Otherwise the
+// third color is the average and the fourth is transparent black.
+static void GetPalette(UINT16 color0, UINT16 color1, int palette[4][3])
+{
+	UnpackRgb565(color0, palette[0]);
+	UnpackRgb565(color1, palette[1]);
+	for (int c = 0; c < 3; ++c)
+	{
+		if (color0 > color1)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+}
+
+// Builds the block for a pair of endpoints, each texel taking the nearest palette color, and returns its squared
+// error. Equal endpoints can only be encoded in the three color mode, where index 0 alone is used.
+static float EncodeWithEndpoints(BlockTexels const& texels, UINT16 color0, UINT16 color1, UINT64* block)
+{
+	if (color0 < color1)
+	{
+		std::swap(color0, color1);
+	}
+
+	int palette[4][3];
+	GetPalette(color0, color1, palette);
+	int colorCount = color0 == color1 ? 1 : 4;
+
+	UINT indices = 0;
+	float blockError = 0.0f;
+	for (int i = 0; i < 16; ++i)
+	{
+		UINT bestIndex = 0;
+		float bestError = FLT_MAX;
+		for (int p = 0; p < colorCount; ++p)
+		{
+			float error = 0.0f;
+			for (int c = 0; c < 3; ++c)
+			{
+				float difference = texels[i][c] - static_cast<float>(palette[p][c]);
+				error += difference * difference;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				bestIndex = p;
+			}
+		}
+		indices |= bestIndex << (i * 2);
+		blockError += bestError;
+	}
+
+	*block = static_cast<UINT64>(color0) | (static_cast<UINT64>(color1) << 16) | (static_cast<UINT64>(indices) << 32);
+	return blockError;
+}
+
+// Endpoints at the extremes of the colors along their principal axis, then refit by least squares to the
+// palette choices those gave, keeping whichever encodes with less error.
+static UINT64 EncodeBlock(BlockTexels const& texels)
+{
+	float mean[3] = {};
+	float minColor[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float maxColor[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (int i = 0; i < 16; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			mean[c] += texels[i][c] / 16.0f;
+			minColor[c] = min(minColor[c], texels[i][c]);
+			maxColor[c] = max(maxColor[c], texels[i][c]);
+		}
+	}
+
+	float covariance[3][3] = {};
+	for (int i = 0; i < 16; ++i)
+	{
+		float d[3] = { texels[i][0] - mean[0], texels[i][1] - mean[1], texels[i][2] - mean[2] };
+		for (int row = 0; row < 3; ++row)
+		{
+			for (int column = 0; column < 3; ++column)
+			{
+				covariance[row][column] += d[row] * d[column];
+			}
+		}
+	}
+
+	// Power iteration, starting from the bounding box diagonal
+	float axis[3] = { maxColor[0] - minColor[0], maxColor[1] - minColor[1], maxColor[2] - minColor[2] };
+	for (int iteration = 0; iteration < 8; ++iteration)
+	{
+		float next[3];
+		for (int row = 0; row < 3; ++row)
+		{
+			next[row] = covariance[row][0] * axis[0] + covariance[row][1] * axis[1] + covariance[row][2] * axis[2];
+		}
+		float length = max(max(fabsf(next[0]), fabsf(next[1])), fabsf(next[2]));
+		if (length < 1e-6f)
+			break;
+		for (int c = 0; c < 3; ++c)
+		{
+			axis[c] = next[c] / length;
+		}
+	}
+
+	int minTexel = 0;
+	int maxTexel = 0;
+	float minProjection = FLT_MAX;
+	float maxProjection = -FLT_MAX;
+	for (int i = 0; i < 16; ++i)
+	{
+		float projection = texels[i][0] * axis[0] + texels[i][1] * axis[1] + texels[i][2] * axis[2];
+		if (projection < minProjection)
+		{
+			minProjection = projection;
+			minTexel = i;
+		}
+		if (projection > maxProjection)
+		{
+			maxProjection = projection;
+			maxTexel = i;
+		}
+	}
+
+	UINT64 block;
+	float error = EncodeWithEndpoints(texels, PackRgb565(texels[maxTexel]), PackRgb565(texels[minTexel]), &block);
+	if (error == 0.0f)
+		return block;
+
+	// Solve for the endpoints that best give each texel as the blend of them its index picked.
+	static const float endpoint0Weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[3] = {}, bx[3] = {};
+	for (int i = 0; i < 16; ++i)
+	{
+		float a = endpoint0Weights[(block >> (32 + i * 2)) & 0x3];
+		float b = 1.0f - a;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int c = 0; c < 3; ++c)
+		{
+			ax[c] += a * texels[i][c];
+			bx[c] += b * texels[i][c];
+		}
+	}
+
+	float determinant = aa * bb - ab * ab;
+	if (fabsf(determinant) > 1e-6f)
+	{
+		float endpoint0[3], endpoint1[3];
+		for (int c = 0; c < 3; ++c)
+		{
+			endpoint0[c] = (bb * ax[c] - ab * bx[c]) / determinant;
+			endpoint1[c] = (aa * bx[c] - ab * ax[c]) / determinant;
+		}
+
+		UINT64 refitBlock;
+		if (EncodeWithEndpoints(texels, PackRgb565(endpoint0), PackRgb565(endpoint1), &refitBlock) < error)
+		{
+			block = refitBlock;
+		}
+	}
+	return block;
+}
+
+UINT GetBlockCount(UINT size)
+{
+	return (size + 3) / 4;
+}
+
+void EncodeBc1(UINT const* pixels, UINT width, UINT height, TaskPool* taskPool, std::vector<UINT64>* blocks)
+{
+	UINT blocksWide = GetBlockCount(width);
+	UINT blocksHigh = GetBlockCount(height);
+	blocks->resize(blocksWide * blocksHigh);
+
+	auto encodeBlockRows = [&](UINT blockRowBegin, UINT blockRowEnd)
+	{
+		for (UINT blockY = blockRowBegin; blockY < blockRowEnd; ++blockY)
+		{
+			for (UINT blockX = 0; blockX < blocksWide; ++blockX)
+			{
+				BlockTexels texels;
+				for (UINT i = 0; i < 16; ++i)
+				{
+					UINT x = min(blockX * 4 + i % 4, width - 1);
+					UINT y = min(blockY * 4 + i / 4, height - 1);
+					UINT pixel = pixels[y * width + x];
+					texels[i][0] = static_cast<float>((pixel >> 16) & 0xFF);
+					texels[i][1] = static_cast<float>((pixel >> 8) & 0xFF);
+					texels[i][2] = static_cast<float>(pixel & 0xFF);
+				}
+				(*blocks)[blockY * blocksWide + blockX] = EncodeBlock(texels);
+			}
+		}
+	};
+
+	if (taskPool)
+	{
+		taskPool->ParallelFor(0, blocksHigh, 4, encodeBlockRows);
+	}
+	else
+	{
+		encodeBlockRows(0, blocksHigh);
+	}
+}
+
+void DecodeBc1(UINT64 const* blocks, UINT width, UINT height, UINT* pixels)
+{
+	UINT blocksWide = GetBlockCount(width);
+	for (UINT blockY = 0; blockY < GetBlockCount(height); ++blockY)
+	{
+		for (UINT blockX = 0; blockX < blocksWide; ++blockX)
+		{
+			UINT64 block = blocks[blockY * blocksWide + blockX];
+			UINT16 color0 = static_cast<UINT16>(block);
+			UINT16 color1 = static_cast<UINT16>(block >> 16);
+
+			int palette[4][3];
+			GetPalette(color0, color1, palette);
+
+			for (UINT i = 0; i < 16; ++i)
+			{
+				UINT x = blockX * 4 + i % 4;
+				UINT y = blockY * 4 + i / 4;
+				if (x >= width || y >= height)
+					continue;
+
+				UINT index = (block >> (32 + i * 2)) & 0x3;
+				UINT alpha = (color0 <= color1 && index == 3) ? 0 : 255;
+				pixels[y * width + x] = palette[index][2] | (palette[index][1] << 8) | (palette[index][0] << 16) | (alpha << 24);
+			}
+		}
+	}
+}
+
+double ComputePsnr(UINT const* pixels, UINT const* referencePixels, size_t pixelCount)
+{
+	double squaredError = 0.0;
+	for (size_t i = 0; i < pixelCount; ++i)
+	{
+		for (UINT shift = 0; shift < 24; shift += 8)
+		{
+			double difference = static_cast<double>((pixels[i] >> shift) & 0xFF) - static_cast<double>((referencePixels[i] >> shift) & 0xFF);
+			squaredError += difference * difference;
+		}
+	}
+
+	double meanSquaredError = squaredError / static_cast<double>(pixelCount * 3);
+	if (meanSquaredError == 0.0)
+		return std::numeric_limits<double>::infinity();
+	return 10.0 * log10(255.0 * 255.0 / meanSquaredError);
+}
+
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+class TaskPool;
+
+// BC1 (DXGI_FORMAT_BC1_UNORM) encoding of opaque 32bpp BGRA images, at 8 bytes per 4x4 block. The GPU samples BC1
+// natively, so decoding here is only for measuring the error.
+namespace BlockCompression
+{
+	UINT GetBlockCount(UINT size); // Blocks across a dimension of size texels
+
+	// Partial blocks at the right and bottom edges repeat the last column or row. Block rows are spread over the
+	// task pool when one is given.
+	void EncodeBc1(UINT const* pixels, UINT width, UINT height, TaskPool* taskPool, std::vector<UINT64>* blocks);
+	void DecodeBc1(UINT64 const* blocks, UINT width, UINT height, UINT* pixels);
+
+	// Peak signal to noise ratio over the color channels, in dB
+	double ComputePsnr(UINT const* pixels, UINT const* referencePixels, size_t pixelCount);
+}
@@ -24,6 +24,9 @@ namespace
 DeviceResources::DeviceResources(DXGI_FORMAT backBufferFormat, DXGI_FORMAT depthBufferFormat, UINT backBufferCount, D3D_FEATURE_LEVEL minFeatureLevel, UINT flags, UINT adapterIDoverride) :
     m_backBufferIndex(0),
     m_fenceValues{},
+    m_lastPresentedFenceValue(0),
+    m_maxFrameLatency(0),
+    m_maxFramesInFlight(0),
     m_rtvDescriptorSize(0),
     m_screenViewport{},
     m_scissorRect{},
@@ -268,7 +271,7 @@ void DeviceResources::CreateWindowSizeDependentResources()
             backBufferWidth,
             backBufferHeight,
             backBufferFormat,
-            (m_options & c_AllowTearing) ? DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING : 0
+            GetSwapChainFlags()
         );
 
         if (hr == DXGI_ERROR_DEVICE_REMOVED || hr == DXGI_ERROR_DEVICE_RESET)
@@ -304,7 +307,7 @@ void DeviceResources::CreateWindowSizeDependentResources()
         swapChainDesc.Scaling = DXGI_SCALING_STRETCH;
         swapChainDesc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
         swapChainDesc.AlphaMode = DXGI_ALPHA_MODE_IGNORE;
-        swapChainDesc.Flags = (m_options & c_AllowTearing) ? DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING : 0;
+        swapChainDesc.Flags = GetSwapChainFlags();
 
         DXGI_SWAP_CHAIN_FULLSCREEN_DESC fsSwapChainDesc = { 0 };
         fsSwapChainDesc.Windowed = TRUE;
@@ -329,6 +332,14 @@ void DeviceResources::CreateWindowSizeDependentResources()
 
         ThrowIfFailed(swapChain.As(&m_swapChain));
 
+        // Limit how many frames can be queued ahead of the display, so input shows up in the next frame
+        // rather than behind frames that were already recorded.
+        if (m_maxFrameLatency > 0)
+        {
+            ThrowIfFailed(m_swapChain->SetMaximumFrameLatency(m_maxFrameLatency));
+            m_frameLatencyWaitableObject.Attach(m_swapChain->GetFrameLatencyWaitableObject());
+        }
+
         // With tearing support enabled we will handle ALT+Enter key presses in the
         // window message loop rather than let DXGI handle it by calling SetFullscreenState.
         if (IsTearingSupported())
@@ -465,6 +476,7 @@ void DeviceResources::HandleDeviceLost()
     m_fence.Reset();
     m_rtvDescriptorHeap.Reset();
     m_dsvDescriptorHeap.Reset();
+    m_frameLatencyWaitableObject.Close();
     m_swapChain.Reset();
     m_d3dDevice.Reset();
     m_dxgiFactory.Reset();
@@ -554,6 +566,12 @@ void DeviceResources::Present(D3D12_RESOURCE_STATES beforeState)
         ThrowIfFailed(hr);
 
         MoveToNextFrame();
+
+        // Block until the swap chain can take another frame, so the next one is built from the latest input.
+        if (m_frameLatencyWaitableObject.IsValid())
+        {
+            WaitForSingleObjectEx(m_frameLatencyWaitableObject.Get(), 1000, TRUE);
+        }
     }
 }
 
@@ -592,6 +610,7 @@ void DeviceResources::MoveToNextFrame()
     // Schedule a Signal command in the queue.
     const UINT64 currentFenceValue = m_fenceValues[m_backBufferIndex];
     ThrowIfFailed(m_commandQueue->Signal(m_fence.Get(), currentFenceValue));
+    m_lastPresentedFenceValue = currentFenceValue;
 
     // Update the back buffer index.
     m_backBufferIndex = m_swapChain->GetCurrentBackBufferIndex();
@@ -603,10 +622,32 @@ void DeviceResources::MoveToNextFrame()
         WaitForSingleObjectEx(m_fenceEvent.Get(), INFINITE, FALSE);
     }
 
+    // With fewer frames in flight allowed than there are back buffers, also wait for the frames before that limit.
+    if (m_maxFramesInFlight > 0 && m_maxFramesInFlight < m_backBufferCount)
+    {
+        const UINT64 fenceValueToWaitFor = currentFenceValue - (m_maxFramesInFlight - 1);
+        if (m_fence->GetCompletedValue() < fenceValueToWaitFor)
+        {
+            ThrowIfFailed(m_fence->SetEventOnCompletion(fenceValueToWaitFor, m_fenceEvent.Get()));
+            WaitForSingleObjectEx(m_fenceEvent.Get(), INFINITE, FALSE);
+        }
+    }
+
     // Set the fence value for the next frame.
     m_fenceValues[m_backBufferIndex] = currentFenceValue + 1;
 }
 
+// Swap chain creation and ResizeBuffers must be passed the same flags.
+UINT DeviceResources::GetSwapChainFlags() const
+{
+    UINT flags = (m_options & c_AllowTearing) ? DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING : 0;
+    if (m_maxFrameLatency > 0)
+    {
+        flags |= DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+    }
+    return flags;
+}
+
 // This method acquires the first available hardware adapter that supports Direct3D 12.
 // If no such adapter can be found, try WARP. Otherwise throw an exception.
 void DeviceResources::InitializeAdapter(IDXGIAdapter1** ppAdapter)
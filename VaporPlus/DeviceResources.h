@@ -27,6 +27,8 @@ namespace DX
 
         void InitializeDXGIAdapter();
         void SetAdapterOverride(UINT adapterID) { m_adapterIDoverride = adapterID; }
+        void SetMaximumFrameLatency(UINT maxFrameLatency) { m_maxFrameLatency = maxFrameLatency; } // 0 keeps the DXGI default queue depth
+        void SetMaxFramesInFlight(UINT maxFramesInFlight) { m_maxFramesInFlight = maxFramesInFlight; } // 0 allows one per back buffer
         void CreateDeviceResources();
         void CreateWindowSizeDependentResources();
         void SetWindow(HWND window, int width, int height);
@@ -83,6 +85,8 @@ namespace DX
         unsigned int                GetDeviceOptions() const { return m_options; }
         LPCWSTR                     GetAdapterDescription() const { return m_adapterDescription.c_str(); }
         UINT                        GetAdapterID() const { return m_adapterID; }
+        UINT64                      GetLastPresentedFenceValue() const { return m_lastPresentedFenceValue; }
+        UINT64                      GetCompletedFenceValue() const { return m_fence->GetCompletedValue(); }
 
         CD3DX12_CPU_DESCRIPTOR_HANDLE GetRenderTargetView() const
         {
@@ -95,6 +99,7 @@ namespace DX
 
     private:
         void MoveToNextFrame();
+        UINT GetSwapChainFlags() const;
         void InitializeAdapter(IDXGIAdapter1** ppAdapter);
 
         const static size_t MAX_BACK_BUFFER_COUNT = 3;
@@ -120,8 +125,16 @@ namespace DX
         // Presentation fence objects.
         Microsoft::WRL::ComPtr<ID3D12Fence>                 m_fence;
         UINT64                                              m_fenceValues[MAX_BACK_BUFFER_COUNT];
+        UINT64                                              m_lastPresentedFenceValue;
         Microsoft::WRL::Wrappers::Event                     m_fenceEvent;
 
+        // Signaled when the swap chain can queue another frame. Only created with a maximum frame latency set.
+        Microsoft::WRL::Wrappers::Event                     m_frameLatencyWaitableObject;
+        UINT                                                m_maxFrameLatency;
+
+        // Frames the CPU may have submitted that the GPU hasn't finished
+        UINT                                                m_maxFramesInFlight;
+
         // Direct3D rendering objects.
         Microsoft::WRL::ComPtr<ID3D12DescriptorHeap>        m_rtvDescriptorHeap;
         Microsoft::WRL::ComPtr<ID3D12DescriptorHeap>        m_dsvDescriptorHeap;
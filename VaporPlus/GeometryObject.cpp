@@ -40,6 +40,9 @@ void GeometryObject::LoadCube(
 
 	assert(m_indexBufferOffset % 6 == 0); // Three two-byte indices should be written at a time
 
+	ComputeObjectBounds(*vertices, vertexBaseline);
+	m_netTransform = m_baseTransform;
+	m_previousTransform = m_baseTransform;
 	CreateTransformBuffer(deviceResources, m_baseTransform);
 }
 
@@ -65,10 +68,26 @@ void GeometryObject::LoadObjMesh(
 
 	assert(m_indexBufferOffset % 6 == 0);
 
+	ComputeObjectBounds(*vertices, vertexBaseline);
 	m_baseTransform = transform;
+	m_netTransform = m_baseTransform;
+	m_previousTransform = m_baseTransform;
 	CreateTransformBuffer(deviceResources, m_baseTransform);
 }
 
+void GeometryObject::ComputeObjectBounds(std::vector<Vertex> const& vertices, size_t vertexBaseline)
+{
+	m_boundsMin = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+	m_boundsMax = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	for (size_t i = vertexBaseline; i < vertices.size(); ++i)
+	{
+		XMFLOAT3 const& position = vertices[i].position;
+		m_boundsMin = XMFLOAT3(min(m_boundsMin.x, position.x), min(m_boundsMin.y, position.y), min(m_boundsMin.z, position.z));
+		m_boundsMax = XMFLOAT3(max(m_boundsMax.x, position.x), max(m_boundsMax.y, position.y), max(m_boundsMax.z, position.z));
+	}
+}
+
 struct Matrix3x4
 {
 	FLOAT m[12];
@@ -104,27 +123,27 @@ void GeometryObject::CreateTransformBuffer(DX::DeviceResources * deviceResources
 		&defaultHeapProperties, D3D12_HEAP_FLAG_NONE, &transformTextureDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&m_transformBuffer)));
 	NAME_D3D12_OBJECT(m_transformBuffer);
 
-	const UINT64 uploadBufferSize = GetRequiredIntermediateSize(m_transformBuffer.Get(), 0, 1);
+	const UINT64 uploadBufferSize = requiredBufferSize * deviceResources->GetBackBufferCount();
 
-	// Create the GPU upload buffer.
+	// Create the GPU upload buffer. It stays mapped for per-frame updates.
 	ThrowIfFailed(deviceResources->GetD3DDevice()->CreateCommittedResource(
 		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
 		D3D12_HEAP_FLAG_NONE,
 		&CD3DX12_RESOURCE_DESC::Buffer(uploadBufferSize),
 		D3D12_RESOURCE_STATE_GENERIC_READ,
 		nullptr,
-		IID_PPV_ARGS(&m_transformResourceUploadHeap)));
+		IID_PPV_ARGS(&m_transformUploadRing)));
+	NAME_D3D12_OBJECT(m_transformUploadRing);
 
-	D3D12_SUBRESOURCE_DATA textureData = {};
-	textureData.pData = &transformBuffer;
-	transformBuffer = ToMatrix3x4(transform);
+	CD3DX12_RANGE readRange(0, 0);
+	ThrowIfFailed(m_transformUploadRing->Map(0, &readRange, reinterpret_cast<void**>(&m_mappedTransformUploadRing)));
 
-	textureData.RowPitch = requiredBufferSize;
-	textureData.SlicePitch = textureData.RowPitch;
+	transformBuffer = ToMatrix3x4(transform);
+	memcpy(m_mappedTransformUploadRing, &transformBuffer, requiredBufferSize);
 
 	deviceResources->PrepareOffscreen();
 
-	UpdateSubresources(deviceResources->GetCommandList(), m_transformBuffer.Get(), m_transformResourceUploadHeap.Get(), 0, 0, 1, &textureData);
+	deviceResources->GetCommandList()->CopyBufferRegion(m_transformBuffer.Get(), 0, m_transformUploadRing.Get(), 0, requiredBufferSize);
 	deviceResources->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_transformBuffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
 	deviceResources->ExecuteCommandList();
 	deviceResources->WaitForGpu();
@@ -146,6 +165,7 @@ void GeometryObject::UpdateFloatyTransform(DX::DeviceResources * deviceResources
 		transform = transform * XMMatrixRotationAxis(yAxis, angle);
 	}
 
+	m_previousTransform = m_netTransform;
 	m_netTransform = transform * m_baseTransform;
 
 	UpdateTransform(deviceResources, m_netTransform);
@@ -156,6 +176,17 @@ XMMATRIX GeometryObject::GetTransform() const
 	return m_netTransform;
 }
 
+XMMATRIX GeometryObject::GetPreviousTransform() const
+{
+	return m_previousTransform;
+}
+
+void GeometryObject::GetObjectBounds(XMFLOAT3* boundsMin, XMFLOAT3* boundsMax) const
+{
+	*boundsMin = m_boundsMin;
+	*boundsMax = m_boundsMax;
+}
+
 void GeometryObject::UpdateTransform(DX::DeviceResources * deviceResources, XMMATRIX const& transform)
 {
 	deviceResources->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
@@ -163,11 +194,12 @@ void GeometryObject::UpdateTransform(DX::DeviceResources * deviceResources, XMMA
 		D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, // State changed after BLAS build
 		D3D12_RESOURCE_STATE_COPY_DEST));
 
-	D3D12_SUBRESOURCE_DATA textureData = {};
+	// This frame index's slot was last read by the frame that used it before, which has finished.
 	Matrix3x4 transformBuffer = ToMatrix3x4(transform);
-	textureData.pData = &transformBuffer;
+	UINT64 slotOffset = sizeof(transformBuffer) * deviceResources->GetCurrentFrameIndex();
+	memcpy(m_mappedTransformUploadRing + slotOffset, &transformBuffer, sizeof(transformBuffer));
 
-	UpdateSubresources(deviceResources->GetCommandList(), m_transformBuffer.Get(), m_transformResourceUploadHeap.Get(), 0, 0, 1, &textureData);
+	deviceResources->GetCommandList()->CopyBufferRegion(m_transformBuffer.Get(), 0, m_transformUploadRing.Get(), slotOffset, sizeof(transformBuffer));
 
 	deviceResources->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
 		m_transformBuffer.Get(),
@@ -175,7 +207,7 @@ void GeometryObject::UpdateTransform(DX::DeviceResources * deviceResources, XMMA
 		D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
 }
 
-D3D12_RAYTRACING_GEOMETRY_DESC GeometryObject::GetRaytracingGeometryDesc(D3DBuffer * vertexBuffer, D3DBuffer * indexBuffer, int totalVertexCount)
+D3D12_RAYTRACING_GEOMETRY_DESC GeometryObject::GetRaytracingGeometryDesc(D3DBuffer * positionBuffer, D3DBuffer * indexBuffer, int totalVertexCount)
 {
 	D3D12_RAYTRACING_GEOMETRY_DESC geometryDesc = {};
 	geometryDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
@@ -184,9 +216,9 @@ D3D12_RAYTRACING_GEOMETRY_DESC GeometryObject::GetRaytracingGeometryDesc(D3DBuff
 	geometryDesc.Triangles.IndexFormat = DXGI_FORMAT_R16_UINT;
 	geometryDesc.Triangles.Transform3x4 = m_transformBuffer->GetGPUVirtualAddress();
 	geometryDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
-	geometryDesc.Triangles.VertexBuffer.StartAddress = vertexBuffer->resource->GetGPUVirtualAddress();
+	geometryDesc.Triangles.VertexBuffer.StartAddress = positionBuffer->resource->GetGPUVirtualAddress();
 	geometryDesc.Triangles.VertexCount = totalVertexCount;
-	geometryDesc.Triangles.VertexBuffer.StrideInBytes = sizeof(Vertex);
+	geometryDesc.Triangles.VertexBuffer.StrideInBytes = sizeof(XMFLOAT3); // Position-only stream, see VaporPlus::BuildGeometry
 
 	// Mark the geometry as opaque. 
 	// PERFORMANCE TIP: mark geometry as opaque whenever applicable as it can enable important ray processing optimizations.
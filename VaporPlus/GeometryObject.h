@@ -6,7 +6,9 @@ class ObjLoader;
 
 class GeometryObject
 {
-	ComPtr<ID3D12Resource> m_transformResourceUploadHeap;
+	// One upload slot per frame in flight, so writing this frame's transform doesn't race the copy of an earlier one
+	ComPtr<ID3D12Resource> m_transformUploadRing;
+	uint8_t* m_mappedTransformUploadRing;
 
 	TextureIdentifier m_textureID;
 
@@ -24,6 +26,11 @@ class GeometryObject
 	bool m_spin;
 	XMMATRIX m_baseTransform;
 	XMMATRIX m_netTransform;
+	XMMATRIX m_previousTransform;
+
+	// Object-space bounds of the vertices, before any transform
+	XMFLOAT3 m_boundsMin;
+	XMFLOAT3 m_boundsMax;
 
 public:
 	void Initialize(TextureIdentifier textureIdentifier, uint32_t material);
@@ -52,7 +59,7 @@ public:
 		std::vector<Vertex>* floorVertices,
 		std::vector<Index>* indices);
 
-	D3D12_RAYTRACING_GEOMETRY_DESC GetRaytracingGeometryDesc(D3DBuffer* vertexBuffer, D3DBuffer* indexBuffer, int totalVertexCount);
+	D3D12_RAYTRACING_GEOMETRY_DESC GetRaytracingGeometryDesc(D3DBuffer* positionBuffer, D3DBuffer* indexBuffer, int totalVertexCount);
 
 	TextureIdentifier GetTextureIdentifier() const
 	{
@@ -67,6 +74,9 @@ public:
 	void UpdateTransform(DX::DeviceResources* deviceResources, XMMATRIX const& transform);
 
 	XMMATRIX GetTransform() const;
+	XMMATRIX GetPreviousTransform() const;
+
+	void GetObjectBounds(XMFLOAT3* boundsMin, XMFLOAT3* boundsMax) const;
 
 	void SetFloatAnimationCounter(uint32_t animationCounter)
 	{
@@ -86,4 +96,5 @@ public:
 
 private:
 	void CreateTransformBuffer(DX::DeviceResources* deviceResources, XMMATRIX transform);
+	void ComputeObjectBounds(std::vector<Vertex> const& vertices, size_t vertexBaseline);
 }; 
\ No newline at end of file
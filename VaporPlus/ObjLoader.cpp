@@ -1,81 +1,130 @@
 #include "stdafx.h"
 #include "ObjLoader.h"
+#include "TaskPool.h"
 
-void ObjLoader::Load(wchar_t const* fileName)
+void ObjLoader::Load(wchar_t const* fileName, TaskPool* taskPool)
 {
 	std::ifstream fileStream(fileName);
+	std::vector<std::string> lines;
 	std::string line;
-	
-	Object* currentObject = nullptr;
 
 	while (fileStream.good())
 	{
 		std::getline(fileStream, line);
+		lines.push_back(line);
+	}
 
-		if (line.length() == 0)
-			continue;
-
-		std::string objectIdentifierPrefix = "# object ";
-		if (line.find(objectIdentifierPrefix) == 0)
-		{
-			currentObject = GetOrCreateObject(line.substr(objectIdentifierPrefix.length()));
-
-		}
-		else if (line[0] == 'v' && line[1] == ' ')
-		{
-			XMFLOAT3 vertex;
-			std::stringstream stringStream(line.substr(1));
-			stringStream >> vertex.x >> vertex.y >> vertex.z;
-			currentObject->AddVertex(vertex);
-		}
-		else if (line[0] == 'v' && line[1] == 'n'&& line[2] == ' ')
+	// Lines parse independently, so that's done in parallel when there's a pool. Objects are then assembled in file
+	// order.
+	std::vector<ParsedLine> parsedLines(lines.size());
+	auto parseLines = [&](UINT begin, UINT end)
+	{
+		for (UINT i = begin; i < end; ++i)
 		{
-			XMFLOAT3 normal;
-			std::stringstream stringStream(line.substr(2));
-			stringStream >> normal.x >> normal.y >> normal.z;
-			currentObject->AddNormal(normal);
+			ParseLine(lines[i], &parsedLines[i]);
 		}
-		else if (line[0] == 'g' && line[1] == ' ')
+	};
+	if (taskPool)
+	{
+		taskPool->ParallelFor(0, CheckCastUint(lines.size()), 1024, parseLines);
+	}
+	else
+	{
+		parseLines(0, CheckCastUint(lines.size()));
+	}
+
+	Object* currentObject = nullptr;
+
+	for (ParsedLine const& parsedLine : parsedLines)
+	{
+		switch (parsedLine.LineType)
 		{
-			std::string objectName = line.substr(2);
-			currentObject = GetOrCreateObject(objectName);
+		case ParsedLine::Type::Object:
+			currentObject = GetOrCreateObject(parsedLine.ObjectName);
+			break;
+		case ParsedLine::Type::Vertex:
+			currentObject->AddVertex(parsedLine.Value);
+			break;
+		case ParsedLine::Type::Normal:
+			currentObject->AddNormal(parsedLine.Value);
+			break;
+		case ParsedLine::Type::Face:
+			if (parsedLine.UseNormals)
+			{
+				currentObject->AddFace(parsedLine.VertexIndices, parsedLine.NormalIndices);
+			}
+			else
+			{
+				currentObject->AddFace(parsedLine.VertexIndices);
+			}
+			break;
+		default:
+			break;
 		}
-		else if (line[0] == 'f' && line[1] == ' ')
-		{
-			size_t delim1 = line.find('/');
-			size_t delim2 = line.find('/', delim1);
+	}
+}
 
-			bool useNormals = delim1 != -1;
+void ObjLoader::ParseLine(std::string const& line, ParsedLine* parsedLine)
+{
+	if (line.length() == 0)
+		return;
 
-			if (useNormals)
-			{
-				// Face info includes normals
-				std::string tokens[3];
-				std::stringstream stringStream(line.substr(1));
-				stringStream >> tokens[0] >> tokens[1] >> tokens[2];
+	std::string objectIdentifierPrefix = "# object ";
+	if (line.find(objectIdentifierPrefix) == 0)
+	{
+		parsedLine->LineType = ParsedLine::Type::Object;
+		parsedLine->ObjectName = line.substr(objectIdentifierPrefix.length());
+	}
+	else if (line[0] == 'v' && line[1] == ' ')
+	{
+		XMFLOAT3 vertex;
+		std::stringstream stringStream(line.substr(1));
+		stringStream >> vertex.x >> vertex.y >> vertex.z;
+		parsedLine->LineType = ParsedLine::Type::Vertex;
+		parsedLine->Value = vertex;
+	}
+	else if (line[0] == 'v' && line[1] == 'n'&& line[2] == ' ')
+	{
+		XMFLOAT3 normal;
+		std::stringstream stringStream(line.substr(2));
+		stringStream >> normal.x >> normal.y >> normal.z;
+		parsedLine->LineType = ParsedLine::Type::Normal;
+		parsedLine->Value = normal;
+	}
+	else if (line[0] == 'g' && line[1] == ' ')
+	{
+		parsedLine->LineType = ParsedLine::Type::Object;
+		parsedLine->ObjectName = line.substr(2);
+	}
+	else if (line[0] == 'f' && line[1] == ' ')
+	{
+		size_t delim1 = line.find('/');
 
-				XMUINT2 vertexAndNormal[3];
-				for (int i = 0; i<3; ++i)
-					vertexAndNormal[i] = GetVertexAndNormalIndex(tokens[i]);
+		parsedLine->LineType = ParsedLine::Type::Face;
+		parsedLine->UseNormals = delim1 != -1;
 
-				Object::ThreeIndices vertexIndices;
-				for (int i = 0; i<3; ++i)
-					vertexIndices.Values[i] = vertexAndNormal[i].x;
+		if (parsedLine->UseNormals)
+		{
+			// Face info includes normals
+			std::string tokens[3];
+			std::stringstream stringStream(line.substr(1));
+			stringStream >> tokens[0] >> tokens[1] >> tokens[2];
 
-				Object::ThreeIndices normalIndices;
-				for (int i = 0; i<3; ++i)
-					normalIndices.Values[i] = vertexAndNormal[i].y;
+			XMUINT2 vertexAndNormal[3];
+			for (int i = 0; i<3; ++i)
+				vertexAndNormal[i] = GetVertexAndNormalIndex(tokens[i]);
 
-				currentObject->AddFace(vertexIndices, normalIndices);
-			}
-			else
-			{
-				// No normals
-				Object::ThreeIndices vertexIndices;
-				std::stringstream stringStream(line.substr(1));
-				stringStream >> vertexIndices.Values[0] >> vertexIndices.Values[1] >> vertexIndices.Values[2];
-				currentObject->AddFace(vertexIndices);
-			}
+			for (int i = 0; i<3; ++i)
+				parsedLine->VertexIndices.Values[i] = vertexAndNormal[i].x;
+
+			for (int i = 0; i<3; ++i)
+				parsedLine->NormalIndices.Values[i] = vertexAndNormal[i].y;
+		}
+		else
+		{
+			// No normals
+			std::stringstream stringStream(line.substr(1));
+			stringStream >> parsedLine->VertexIndices.Values[0] >> parsedLine->VertexIndices.Values[1] >> parsedLine->VertexIndices.Values[2];
 		}
 	}
 }
@@ -2,6 +2,8 @@
 #include "RaytracingHlslCompat.h"
 #include "CheckCast.h"
 
+class TaskPool;
+
 class ObjLoader
 {
 	class Object
@@ -62,8 +64,21 @@ class ObjLoader
 
 	std::vector<Object> m_objects;
 
+	// One line of the file, parsed on its own
+	struct ParsedLine
+	{
+		enum class Type { None, Object, Vertex, Normal, Face };
+		Type LineType = Type::None;
+		std::string ObjectName;
+		XMFLOAT3 Value;
+		bool UseNormals;
+		Object::ThreeIndices VertexIndices;
+		Object::ThreeIndices NormalIndices;
+	};
+
 public:
-	void Load(wchar_t const* fileName);
+	// Lines are parsed on taskPool's threads, or on the calling thread if it's null.
+	void Load(wchar_t const* fileName, TaskPool* taskPool);
 
 	void GetObjectVerticesAndIndices(
 		std::string const& name,
@@ -86,4 +101,5 @@ private:
 	Object* GetObject(std::string const& name);
 	Object* GetOrCreateObject(std::string const& name);
 	XMUINT2 GetVertexAndNormalIndex(std::string const& token);
+	void ParseLine(std::string const& line, ParsedLine* parsedLine);
 };
\ No newline at end of file
@@ -0,0 +1,351 @@
+#include "stdafx.h"
+#include "PixelFormat.h"
+#include <intrin.h>
+
+namespace PixelFormat
+{
+
+// SSE2 is part of x64.
+static InstructionSet DetectInstructionSet()
+{
+	int info[4];
+	__cpuid(info, 0);
+	int highestLeaf = info[0];
+
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 9)) == 0)
+		return InstructionSet::Sse2;
+
+	// AVX2 also needs the OS to save the YMM registers.
+	bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+	if (highestLeaf >= 7 && osSavesYmm)
+	{
+		__cpuidex(info, 7, 0);
+		if ((info[1] & (1 << 5)) != 0)
+			return InstructionSet::Avx2;
+	}
+	return InstructionSet::Ssse3;
+}
+
+static const InstructionSet s_supportedInstructionSet = DetectInstructionSet();
+static InstructionSet s_instructionSet = s_supportedInstructionSet;
+
+InstructionSet GetSupportedInstructionSet()
+{
+	return s_supportedInstructionSet;
+}
+
+void SetInstructionSet(InstructionSet instructionSet)
+{
+	s_instructionSet = min(instructionSet, s_supportedInstructionSet);
+}
+
+// round(color * alpha / 255), exactly, without a division
+static inline UINT MultiplyUnorm8(UINT color, UINT alpha)
+{
+	UINT product = color * alpha + 128;
+	return (product + (product >> 8)) >> 8;
+}
+
+static inline UINT PackBgra(UINT b, UINT g, UINT r, UINT a)
+{
+	return b | (g << 8) | (r << 16) | (a << 24);
+}
+
+static UINT ConvertPixel(Source source, BYTE const* pixel)
+{
+	switch (source)
+	{
+	case Source::Gray8:
+		return PackBgra(pixel[0], pixel[0], pixel[0], 255);
+	case Source::Rgb8:
+		return PackBgra(pixel[2], pixel[1], pixel[0], 255);
+	case Source::Bgr8:
+		return PackBgra(pixel[0], pixel[1], pixel[2], 255);
+	case Source::Rgba8:
+		return PackBgra(MultiplyUnorm8(pixel[2], pixel[3]), MultiplyUnorm8(pixel[1], pixel[3]), MultiplyUnorm8(pixel[0], pixel[3]), pixel[3]);
+	case Source::Bgra8:
+		return PackBgra(MultiplyUnorm8(pixel[0], pixel[3]), MultiplyUnorm8(pixel[1], pixel[3]), MultiplyUnorm8(pixel[2], pixel[3]), pixel[3]);
+	case Source::PremultipliedRgba8:
+		return PackBgra(pixel[2], pixel[1], pixel[0], pixel[3]);
+	case Source::PremultipliedBgra8:
+		return PackBgra(pixel[0], pixel[1], pixel[2], pixel[3]);
+	}
+	assert(false);
+	return 0;
+}
+
+// The 32bpp paths widen to 16 bits per channel, where the channels of a pixel are four lanes that can be reordered
+// and multiplied by the alpha lane, then narrow back. The alpha lane is multiplied by 255 to leave it unchanged.
+template<bool SwapRedBlue, bool Premultiply>
+static inline __m128i ConvertBgra8x2Sse2(__m128i pixels)
+{
+	if (SwapRedBlue)
+	{
+		pixels = _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+	}
+	if (Premultiply)
+	{
+		__m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		alpha = _mm_or_si128(alpha, _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0));
+		__m128i product = _mm_add_epi16(_mm_mullo_epi16(pixels, alpha), _mm_set1_epi16(128));
+		pixels = _mm_srli_epi16(_mm_add_epi16(product, _mm_srli_epi16(product, 8)), 8);
+	}
+	return pixels;
+}
+
+template<bool SwapRedBlue, bool Premultiply>
+static size_t ConvertBgra8Sse2(BYTE const* source, UINT* destination, size_t pixelCount)
+{
+	size_t i = 0;
+	for (; i + 4 <= pixelCount; i += 4)
+	{
+		__m128i pixels = _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + i * 4));
+		__m128i low = ConvertBgra8x2Sse2<SwapRedBlue, Premultiply>(_mm_unpacklo_epi8(pixels, _mm_setzero_si128()));
+		__m128i high = ConvertBgra8x2Sse2<SwapRedBlue, Premultiply>(_mm_unpackhi_epi8(pixels, _mm_setzero_si128()));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_packus_epi16(low, high));
+	}
+	return i;
+}
+
+// Unpacking and packing both work within 128-bit lanes, so the pixel order survives the round trip.
+template<bool SwapRedBlue, bool Premultiply>
+static inline __m256i ConvertBgra8x4Avx2(__m256i pixels)
+{
+	if (SwapRedBlue)
+	{
+		pixels = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+	}
+	if (Premultiply)
+	{
+		__m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		alpha = _mm256_or_si256(alpha, _mm256_set_epi16(255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0));
+		__m256i product = _mm256_add_epi16(_mm256_mullo_epi16(pixels, alpha), _mm256_set1_epi16(128));
+		pixels = _mm256_srli_epi16(_mm256_add_epi16(product, _mm256_srli_epi16(product, 8)), 8);
+	}
+	return pixels;
+}
+
+template<bool SwapRedBlue, bool Premultiply>
+static size_t ConvertBgra8Avx2(BYTE const* source, UINT* destination, size_t pixelCount)
+{
+	size_t i = 0;
+	for (; i + 8 <= pixelCount; i += 8)
+	{
+		__m256i pixels = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(source + i * 4));
+		__m256i low = ConvertBgra8x4Avx2<SwapRedBlue, Premultiply>(_mm256_unpacklo_epi8(pixels, _mm256_setzero_si256()));
+		__m256i high = ConvertBgra8x4Avx2<SwapRedBlue, Premultiply>(_mm256_unpackhi_epi8(pixels, _mm256_setzero_si256()));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), _mm256_packus_epi16(low, high));
+	}
+	_mm256_zeroupper();
+	return i;
+}
+
+template<bool SwapRedBlue, bool Premultiply>
+static size_t ConvertBgra8(BYTE const* source, UINT* destination, size_t pixelCount)
+{
+	if (s_instructionSet >= InstructionSet::Avx2)
+	{
+		return ConvertBgra8Avx2<SwapRedBlue, Premultiply>(source, destination, pixelCount);
+	}
+	if (s_instructionSet >= InstructionSet::Sse2)
+	{
+		return ConvertBgra8Sse2<SwapRedBlue, Premultiply>(source, destination, pixelCount);
+	}
+	return 0;
+}
+
+// Four pixels per 16-byte load, which reads four bytes past them. Those have to be in the source, so the last
+// six pixels or fewer are left to the scalar loop.
+static size_t ConvertRgb8Ssse3(BYTE const* source, UINT* destination, size_t pixelCount, bool swapRedBlue)
+{
+	const __m128i shuffle = swapRedBlue
+		? _mm_setr_epi8(2, 1, 0, -128, 5, 4, 3, -128, 8, 7, 6, -128, 11, 10, 9, -128)
+		: _mm_setr_epi8(0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128);
+	const __m128i opaque = _mm_set1_epi32(static_cast<int>(0xFF000000));
+
+	size_t i = 0;
+	for (; i + 6 <= pixelCount; i += 4)
+	{
+		__m128i pixels = _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + i * 3));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), opaque));
+	}
+	return i;
+}
+
+// Interleaving the gray bytes with themselves, then with themselves and the alpha, gives G G G A per pixel.
+static size_t ConvertGray8Sse2(BYTE const* source, UINT* destination, size_t pixelCount)
+{
+	const __m128i opaque = _mm_set1_epi8(-1);
+
+	size_t i = 0;
+	for (; i + 16 <= pixelCount; i += 16)
+	{
+		__m128i gray = _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + i));
+		__m128i grayGray = _mm_unpacklo_epi8(gray, gray);
+		__m128i grayAlpha = _mm_unpacklo_epi8(gray, opaque);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_unpacklo_epi16(grayGray, grayAlpha));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i + 4), _mm_unpackhi_epi16(grayGray, grayAlpha));
+		grayGray = _mm_unpackhi_epi8(gray, gray);
+		grayAlpha = _mm_unpackhi_epi8(gray, opaque);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i + 8), _mm_unpacklo_epi16(grayGray, grayAlpha));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i + 12), _mm_unpackhi_epi16(grayGray, grayAlpha));
+	}
+	return i;
+}
+
+// Four destination pixels from eight source pixels of each of the two rows. The even and odd pixels are split apart,
+// and the four pixels of each block summed in 16 bits per channel.
+static UINT DownsampleRowSse2(UINT const* row0, UINT const* row1, UINT* destination, UINT destinationWidth)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i rounding = _mm_set1_epi16(2);
+
+	UINT x = 0;
+	for (; x + 4 <= destinationWidth; x += 4)
+	{
+		__m128 a0 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<__m128i const*>(row0 + x * 2)));
+		__m128 b0 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<__m128i const*>(row0 + x * 2 + 4)));
+		__m128 a1 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<__m128i const*>(row1 + x * 2)));
+		__m128 b1 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<__m128i const*>(row1 + x * 2 + 4)));
+		__m128i even0 = _mm_castps_si128(_mm_shuffle_ps(a0, b0, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m128i odd0 = _mm_castps_si128(_mm_shuffle_ps(a0, b0, _MM_SHUFFLE(3, 1, 3, 1)));
+		__m128i even1 = _mm_castps_si128(_mm_shuffle_ps(a1, b1, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m128i odd1 = _mm_castps_si128(_mm_shuffle_ps(a1, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+
+		__m128i low = _mm_add_epi16(
+			_mm_add_epi16(_mm_unpacklo_epi8(even0, zero), _mm_unpacklo_epi8(odd0, zero)),
+			_mm_add_epi16(_mm_unpacklo_epi8(even1, zero), _mm_unpacklo_epi8(odd1, zero)));
+		__m128i high = _mm_add_epi16(
+			_mm_add_epi16(_mm_unpackhi_epi8(even0, zero), _mm_unpackhi_epi8(odd0, zero)),
+			_mm_add_epi16(_mm_unpackhi_epi8(even1, zero), _mm_unpackhi_epi8(odd1, zero)));
+		low = _mm_srli_epi16(_mm_add_epi16(low, rounding), 2);
+		high = _mm_srli_epi16(_mm_add_epi16(high, rounding), 2);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + x), _mm_packus_epi16(low, high));
+	}
+	return x;
+}
+
+void DownsampleBgra8(UINT const* sourcePixels, UINT sourceWidth, UINT sourceHeight, UINT* destinationPixels)
+{
+	UINT destinationWidth = max(sourceWidth / 2, 1u);
+	UINT destinationHeight = max(sourceHeight / 2, 1u);
+
+	for (UINT y = 0; y < destinationHeight; ++y)
+	{
+		UINT const* row0 = sourcePixels + min(y * 2, sourceHeight - 1) * sourceWidth;
+		UINT const* row1 = sourcePixels + min(y * 2 + 1, sourceHeight - 1) * sourceWidth;
+		UINT* destination = destinationPixels + y * destinationWidth;
+
+		UINT x = sourceWidth > 1 && s_instructionSet >= InstructionSet::Sse2 ? DownsampleRowSse2(row0, row1, destination, destinationWidth) : 0;
+		for (; x < destinationWidth; ++x)
+		{
+			UINT x0 = min(x * 2, sourceWidth - 1);
+			UINT x1 = min(x * 2 + 1, sourceWidth - 1);
+			UINT pixel = 0;
+			for (UINT shift = 0; shift < 32; shift += 8)
+			{
+				UINT sum = ((row0[x0] >> shift) & 0xFF) + ((row0[x1] >> shift) & 0xFF) + ((row1[x0] >> shift) & 0xFF) + ((row1[x1] >> shift) & 0xFF);
+				pixel |= ((sum + 2) >> 2) << shift;
+			}
+			destination[x] = pixel;
+		}
+	}
+}
+
+UINT GetMipLevelCount(UINT width, UINT height)
+{
+	UINT levelCount = 1;
+	while (width > 1 || height > 1)
+	{
+		width = max(width / 2, 1u);
+		height = max(height / 2, 1u);
+		++levelCount;
+	}
+	return levelCount;
+}
+
+bool FromWicFormat(WICPixelFormatGUID const& wicFormat, Source* source)
+{
+	struct FormatMapping
+	{
+		WICPixelFormatGUID const* WicFormat;
+		Source Format;
+	};
+	static const FormatMapping mappings[] =
+	{
+		{ &GUID_WICPixelFormat8bppGray, Source::Gray8 },
+		{ &GUID_WICPixelFormat24bppRGB, Source::Rgb8 },
+		{ &GUID_WICPixelFormat24bppBGR, Source::Bgr8 },
+		{ &GUID_WICPixelFormat32bppRGBA, Source::Rgba8 },
+		{ &GUID_WICPixelFormat32bppBGRA, Source::Bgra8 },
+		{ &GUID_WICPixelFormat32bppPRGBA, Source::PremultipliedRgba8 },
+		{ &GUID_WICPixelFormat32bppPBGRA, Source::PremultipliedBgra8 },
+	};
+
+	for (auto const& mapping : mappings)
+	{
+		if (IsEqualGUID(wicFormat, *mapping.WicFormat))
+		{
+			*source = mapping.Format;
+			return true;
+		}
+	}
+	return false;
+}
+
+UINT GetBytesPerPixel(Source source)
+{
+	switch (source)
+	{
+	case Source::Gray8:
+		return 1;
+	case Source::Rgb8:
+	case Source::Bgr8:
+		return 3;
+	default:
+		return 4;
+	}
+}
+
+void ConvertToPremultipliedBgra8(Source source, BYTE const* sourcePixels, UINT* destinationPixels, size_t pixelCount)
+{
+	size_t converted = 0;
+	switch (source)
+	{
+	case Source::Gray8:
+		if (s_instructionSet >= InstructionSet::Sse2)
+		{
+			converted = ConvertGray8Sse2(sourcePixels, destinationPixels, pixelCount);
+		}
+		break;
+	case Source::Rgb8:
+	case Source::Bgr8:
+		if (s_instructionSet >= InstructionSet::Ssse3)
+		{
+			converted = ConvertRgb8Ssse3(sourcePixels, destinationPixels, pixelCount, source == Source::Rgb8);
+		}
+		break;
+	case Source::Rgba8:
+		converted = ConvertBgra8<true, true>(sourcePixels, destinationPixels, pixelCount);
+		break;
+	case Source::Bgra8:
+		converted = ConvertBgra8<false, true>(sourcePixels, destinationPixels, pixelCount);
+		break;
+	case Source::PremultipliedRgba8:
+		converted = ConvertBgra8<true, false>(sourcePixels, destinationPixels, pixelCount);
+		break;
+	case Source::PremultipliedBgra8:
+		memcpy(destinationPixels, sourcePixels, pixelCount * 4);
+		converted = pixelCount;
+		break;
+	}
+
+	UINT bytesPerPixel = GetBytesPerPixel(source);
+	for (size_t i = converted; i < pixelCount; ++i)
+	{
+		destinationPixels[i] = ConvertPixel(source, sourcePixels + i * bytesPerPixel);
+	}
+}
+
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+// Conversion of decoded image pixels into 32bpp premultiplied BGRA, the layout of DXGI_FORMAT_B8G8R8A8_UNORM and of
+// WIC's GUID_WICPixelFormat32bppPBGRA, and mip generation in that format. Picks an AVX2, SSSE3 or SSE2 path for the
+// running CPU, with a scalar loop for the leftover pixels.
+namespace PixelFormat
+{
+	enum class Source
+	{
+		Gray8,
+		Rgb8,
+		Bgr8,
+		Rgba8,
+		Bgra8,
+		PremultipliedRgba8,
+		PremultipliedBgra8,
+	};
+
+	// Instruction sets the conversions can use, each including the ones before it. Everything the running CPU
+	// supports is used by default. Tests lower it to check each path against the scalar loop; it must not be changed
+	// while a conversion is running.
+	enum class InstructionSet
+	{
+		Scalar,
+		Sse2,
+		Ssse3,
+		Avx2,
+	};
+	InstructionSet GetSupportedInstructionSet();
+	void SetInstructionSet(InstructionSet instructionSet); // Capped at GetSupportedInstructionSet()
+
+	// Returns false for formats without a fast path, which are left to WIC's format converter.
+	bool FromWicFormat(WICPixelFormatGUID const& wicFormat, Source* source);
+	UINT GetBytesPerPixel(Source source);
+
+	// Colors are premultiplied with round(color * alpha / 255). The source is read as tightly packed pixels.
+	void ConvertToPremultipliedBgra8(Source source, BYTE const* sourcePixels, UINT* destinationPixels, size_t pixelCount);
+
+	// Box filters each 2x2 block into one pixel of the next mip level, which is max(size / 2, 1) in each dimension.
+	// Like D3D's mip sizes this rounds down, so an odd last row or column is dropped.
+	void DownsampleBgra8(UINT const* sourcePixels, UINT sourceWidth, UINT sourceHeight, UINT* destinationPixels);
+	UINT GetMipLevelCount(UINT width, UINT height);
+}
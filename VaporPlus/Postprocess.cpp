@@ -94,11 +94,11 @@ void Postprocess::CreateRootSignature(ID3D12Device5* device)
 	srvTableRange[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 2, 0, 0);
 
 	CD3DX12_DESCRIPTOR_RANGE samplerTableRange[1]{};
-	samplerTableRange[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SAMPLER, 1, 0);
+	samplerTableRange[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SAMPLER, 2, 0);
 
 	CD3DX12_ROOT_PARAMETER rootParameters[3];
 	rootParameters[0].InitAsDescriptorTable(ARRAYSIZE(srvTableRange), srvTableRange, D3D12_SHADER_VISIBILITY_PIXEL);
-	rootParameters[1].InitAsConstants(2, 0);
+	rootParameters[1].InitAsConstants(4, 0);
 	rootParameters[2].InitAsDescriptorTable(ARRAYSIZE(samplerTableRange), samplerTableRange, D3D12_SHADER_VISIBILITY_PIXEL);
 
 	CD3DX12_ROOT_SIGNATURE_DESC rootSignatureDesc(ARRAYSIZE(rootParameters), rootParameters);
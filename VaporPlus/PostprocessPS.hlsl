@@ -9,10 +9,14 @@
 //
 //*********************************************************
 
+#define HLSL
+#include "RaytracingHlslCompat.h"
+
 struct DrawConstants
 {
 	int enablePostProcess;
 	float time;
+	float2 raytracedUVScale; // Fraction of the input texture the ray tracer filled, from the top left
 };
 ConstantBuffer<DrawConstants> myDrawConstants : register(b0, space0);
 
@@ -25,6 +29,20 @@ struct PSInput
 Texture2D g_inputTexture : register(t0);
 Texture2D g_tvNoise : register(t1);
 SamplerState g_sampler : register(s0);
+SamplerState g_linearClampSampler : register(s1);
+
+// The ray tracer may have traced at a lower resolution into the top-left part of the input texture.
+// Wrap the way g_sampler would, map into that part, and filter bilinearly to upscale. Coordinates stay half
+// a texel inside the traced part so the filter never reaches texels that weren't written this frame.
+float4 SampleRaytracedInput(float2 uv)
+{
+	float2 textureSize;
+	g_inputTexture.GetDimensions(textureSize.x, textureSize.y);
+
+	float2 halfTexel = 0.5f / textureSize;
+	float2 scaledUV = clamp(frac(uv) * myDrawConstants.raytracedUVScale, halfTexel, myDrawConstants.raytracedUVScale - halfTexel);
+	return g_inputTexture.Sample(g_linearClampSampler, scaledUV);
+}
 
 float4 getLeftMarginColorAdditive(in float2 uv)
 {
@@ -84,7 +102,7 @@ float2 getUVAfterBottomMarginEffect(in float2 uv)
 float4 evaluate(float2 uv)
 {
 	uv = getUVAfterBottomMarginEffect(uv);
-	float4 fragColor = g_inputTexture.Sample(g_sampler, float2(uv));
+	float4 fragColor = SampleRaytracedInput(uv);
 
 	float4 leftMarginColor = getLeftMarginColorAdditive(uv);
 	fragColor += leftMarginColor;
@@ -137,13 +155,13 @@ float4 PSMain(PSInput input) : SV_TARGET
 
 	if (myDrawConstants.enablePostProcess == 0)
 	{
-		fragColor = g_inputTexture.Sample(g_sampler, float2(uv));
+		fragColor = SampleRaytracedInput(uv);
 	}
 	else
 	{
 		// Do multiple samples to create a blur.
 
-		float offset = 0.00065f;
+		float offset = POSTPROCESS_BLUR_OFFSET;
 		float bottomMarginYLimit = 1 - 0.02f;
 		if (uv.y > bottomMarginYLimit)
 		{
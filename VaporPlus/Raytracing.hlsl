@@ -22,16 +22,42 @@ StructuredBuffer<Vertex> Vertices : register(t2, space0);
 Texture2D<float4> CheckerboardTexture : register(t3, space0);
 Texture2D<float4> CityscapeTexture : register(t4, space0);
 Texture2D<float4> TextTexture : register(t5, space0);
+StructuredBuffer<uint> TileOrder : register(t6, space0);
+StructuredBuffer<PerGeometryConstantBuffer> PerGeometryConstants : register(t7, space0);
+RWStructuredBuffer<PrimaryHitRecord> PrimaryHitCache : register(u1);
+RWTexture2D<uint> FloorShadowCache : register(u2);
+RWByteAddressBuffer ShadowRayStats : register(u3);
+RWByteAddressBuffer TextureFeedback : register(u4);
 
 SamplerState TextureSampler : register(s0);
 
 ConstantBuffer<SceneConstantBuffer> g_sceneCB : register(b0);
 ConstantBuffer<PerGeometryConstantBuffer> g_perGeometryCB : register(b1);
 
-TriangleHitGroup MyHitGroup =
+// One hit group per material. Each closest hit shader is the same shading code specialized
+// on a literal material index, so the material branches and unused texture fetches fold away.
+TriangleHitGroup MyHitGroup_Floor =
 {
 	"", // Anyhit shader
-	"MyClosestHitShader", // Closest hit shader
+	"MyClosestHitShader_Floor", // Closest hit shader
+};
+
+TriangleHitGroup MyHitGroup_Statue =
+{
+	"", // Anyhit shader
+	"MyClosestHitShader_Statue", // Closest hit shader
+};
+
+TriangleHitGroup MyHitGroup_Cityscape =
+{
+	"", // Anyhit shader
+	"MyClosestHitShader_Cityscape", // Closest hit shader
+};
+
+TriangleHitGroup MyHitGroup_Text =
+{
+	"", // Anyhit shader
+	"MyClosestHitShader_Text", // Closest hit shader
 };
 
 // Load three 16 bit indices from a byte addressed buffer.
@@ -83,37 +109,222 @@ float3 HitWorldPosition()
 }
 
 // Retrieve attribute at a hit position interpolated from vertex attributes using the hit's barycentrics.
-float3 HitAttribute(float3 vertexAttribute[3], BuiltInTriangleIntersectionAttributes attr)
+float3 HitAttribute(float3 vertexAttribute[3], float2 barycentrics)
 {
     return vertexAttribute[0] +
-        attr.barycentrics.x * (vertexAttribute[1] - vertexAttribute[0]) +
-        attr.barycentrics.y * (vertexAttribute[2] - vertexAttribute[0]);
+        barycentrics.x * (vertexAttribute[1] - vertexAttribute[0]) +
+        barycentrics.y * (vertexAttribute[2] - vertexAttribute[0]);
 }
 
-// Generate a ray in world space for a camera pixel corresponding to an index from the dispatched 2D grid.
-inline void GenerateCameraRay(uint2 index, out float3 origin, out float3 direction)
+// Everything shading needs to know about a hit. Filled from the DXR intrinsics in a closest hit shader,
+// or rebuilt from a cached primary hit record in the ray generation shader.
+struct HitInfo
 {
-    float2 xy = index + 0.5f; // center in the middle of the pixel.
-    float2 screenPos = xy / DispatchRaysDimensions().xy * 2.0 - 1.0;
+	float3 position;
+	float3 rayDirection;
+	float2 barycentrics;
+	uint primitiveIndex;
+	uint geometryID;
+	uint indexBufferOffset;
+	float4 albedo;
+	float3x3 objectToWorld;
+	float coneWidth; // Width of the primary ray's cone at the hit
+};
 
-    // Invert Y for DirectX-style coordinates.
-    screenPos.y = -screenPos.y;
+// Map the dispatch index to a pixel. Each dispatch row is one RAYGEN_TILE_SIZE square tile, and rows
+// follow a Hilbert curve over the screen so rays in flight together stay spatially coherent.
+// In checkerboard mode a row only covers the tile's pixels with (x + y) % 2 == checkerboardParity, and in a
+// progressive pass only the top-left pixel of each progressiveStride square.
+uint2 GetDispatchPixel()
+{
+	uint packedTile = TileOrder[DispatchRaysIndex().y];
+	uint2 tileOrigin = uint2(packedTile & 0xffff, packedTile >> 16) * RAYGEN_TILE_SIZE;
 
-    // Unproject the pixel coordinate into a ray.
-    float4 world = mul(float4(screenPos, 0, 1), g_sceneCB.projectionToWorld);
+	uint pixelInTile = DispatchRaysIndex().x;
+	if (g_sceneCB.progressiveStride > 1)
+	{
+		uint stride = g_sceneCB.progressiveStride;
+		uint pixelsPerRow = RAYGEN_TILE_SIZE / stride;
+		return tileOrigin + uint2(pixelInTile % pixelsPerRow, pixelInTile / pixelsPerRow) * stride;
+	}
+	if (g_sceneCB.checkerboardEnabled)
+	{
+		// Tile origins are even, so parity within the tile is parity on screen.
+		uint row = pixelInTile / (RAYGEN_TILE_SIZE / 2);
+		uint column = (pixelInTile % (RAYGEN_TILE_SIZE / 2)) * 2 + ((row + g_sceneCB.checkerboardParity) & 1);
+		return tileOrigin + uint2(column, row);
+	}
+	return tileOrigin + uint2(pixelInTile % RAYGEN_TILE_SIZE, pixelInTile / RAYGEN_TILE_SIZE);
+}
 
-    world.xyz /= world.w;
+// The traced part of the output, from the top left. It's smaller than RenderTarget when tracing at reduced resolution.
+uint2 GetRaytracingSize()
+{
+	return uint2(g_sceneCB.raytracingWidth, g_sceneCB.raytracingHeight);
+}
+
+uint GetPrimaryHitCacheIndex(uint2 pixel)
+{
+	return pixel.y * g_sceneCB.raytracingWidth + pixel.x;
+}
+
+// Pixels inside these rectangles may see a moving object this frame, or may have seen one when their cached
+// hit was recorded, so their primary rays have to be traced again.
+bool IsInPrimaryHitCacheRetraceRect(uint2 pixel)
+{
+	for (uint i = 0; i < PRIMARY_HIT_CACHE_RETRACE_RECT_COUNT; ++i)
+	{
+		float4 rect = g_sceneCB.primaryHitCacheRetraceRects[i];
+		if (all(pixel >= rect.xy) && all(pixel < rect.zw))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Generate a ray in world space for a camera pixel.
+// Pixel centers unproject onto the near plane affinely, so rather than unprojecting through projectionToWorld
+// per pixel, the direction is stepped from the one for pixel (0, 0) using deltas precomputed once per frame.
+inline void GenerateCameraRay(uint2 index, out float3 origin, out float3 direction)
+{
     origin = g_sceneCB.cameraPosition.xyz;
-    direction = normalize(world.xyz - origin);
+    direction = normalize(
+        g_sceneCB.cameraRayTopLeft.xyz +
+        index.x * g_sceneCB.cameraRayPixelDeltaX.xyz +
+        index.y * g_sceneCB.cameraRayPixelDeltaY.xyz);
+}
+
+// Per-material shading features. Every caller passes a literal material, so these are resolved at compile time.
+bool MaterialHasSpecular(uint materialIndex)
+{
+	return materialIndex == STATUE_MATERIAL;
+}
+
+bool MaterialIsFullbright(uint materialIndex)
+{
+	return materialIndex == CHECKERBOARD_FLOOR_MATERIAL || materialIndex == TEXT_MATERIAL;
 }
 
 // Diffuse lighting calculation.
-float4 CalculateDiffuseLighting(float3 incidentLightRay, float3 normal, float4 diffuseColor)
+float4 CalculateDiffuseLighting(float3 incidentLightRay, float3 normal, float4 diffuseColor, float4 albedo)
 {
 	float3 hitToLight = normalize(-incidentLightRay);
 	float fNDotL = saturate(dot(hitToLight, normal));
 
-	return g_perGeometryCB.albedo * diffuseColor * fNDotL;
+	return albedo * diffuseColor * fNDotL;
+}
+
+// Trace a shadow ray from a hit toward the light. Returns true if anything is in the way.
+bool TraceShadowRay(float3 hitPosition)
+{
+	ShadowRayPayload shadowPayload = { true }; // There's a miss shader to set this to false.
+
+	RayDesc rayDesc;
+	rayDesc.Origin = hitPosition;
+	rayDesc.Direction = normalize(g_sceneCB.lightPosition.xyz - hitPosition);
+	rayDesc.TMin = 0.001;
+	rayDesc.TMax = 10000.0;
+
+	TraceRay(Scene,
+		RAY_FLAG_CULL_BACK_FACING_TRIANGLES
+		| RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH
+		| RAY_FLAG_FORCE_OPAQUE
+		| RAY_FLAG_SKIP_CLOSEST_HIT_SHADER, // We're not running closest hit
+		~0, // Mask
+		1, // RayContributionToHitGroupIndex,
+		0, // MultiplierForGeometryContributionToHitGroupIndex, 
+		1, // Miss shader index
+		rayDesc,
+		shadowPayload);
+
+	return shadowPayload.hit;
+}
+
+// Tally shadow rays traced and answered from the cache, only while there is a cache. One atomic per wave rather than
+// per ray.
+void CountShadowRay(bool traced)
+{
+	if (!g_sceneCB.floorShadowCacheEnabled)
+		return;
+
+	uint tracedCount = WaveActiveCountBits(traced);
+	uint cachedCount = WaveActiveCountBits(!traced);
+	if (WaveIsFirstLane())
+	{
+		ShadowRayStats.InterlockedAdd(SHADOW_RAY_STATS_TRACED_OFFSET, tracedCount);
+		ShadowRayStats.InterlockedAdd(SHADOW_RAY_STATS_CACHED_OFFSET, cachedCount);
+	}
+}
+
+uint2 GetFloorShadowCacheTexel(float2 worldXZ)
+{
+	float4 bounds = g_sceneCB.floorShadowCacheBounds;
+	float2 uv = saturate((worldXZ - bounds.xy) / (bounds.zw - bounds.xy));
+	return min(uint2(uv * float2(FLOOR_SHADOW_CACHE_WIDTH, FLOOR_SHADOW_CACHE_HEIGHT)), uint2(FLOOR_SHADOW_CACHE_WIDTH - 1, FLOOR_SHADOW_CACHE_HEIGHT - 1));
+}
+
+// The light and the floor never move, so shadowing on the floor's top face is cached per texel of a grid over it.
+// Texels that a moving object's shadow could reach are cleared each frame by VaporPlus::UpdateFloorShadowCache.
+bool IsShadowed(float3 hitPosition, float3 normal, uint materialIndex)
+{
+	if (materialIndex == CHECKERBOARD_FLOOR_MATERIAL && g_sceneCB.floorShadowCacheEnabled && normal.y > 0.5f)
+	{
+		uint2 texel = GetFloorShadowCacheTexel(hitPosition.xz);
+		uint cached = FloorShadowCache[texel];
+		if (cached != FLOOR_SHADOW_CACHE_UNKNOWN)
+		{
+			CountShadowRay(false);
+			return cached == FLOOR_SHADOW_CACHE_SHADOWED;
+		}
+
+		CountShadowRay(true);
+		bool shadowed = TraceShadowRay(hitPosition);
+		FloorShadowCache[texel] = shadowed ? FLOOR_SHADOW_CACHE_SHADOWED : FLOOR_SHADOW_CACHE_LIT;
+		return shadowed;
+	}
+
+	CountShadowRay(true);
+	return TraceShadowRay(hitPosition);
+}
+
+float4 MissColor()
+{
+	return float4(1.0f, 0.51, 0.61f, 1.0f);
+}
+
+float4 ShadeHit(HitInfo hit, uint materialIndex);
+
+// Shade a primary hit recorded by an earlier frame, without tracing the primary ray again.
+float4 ShadeCachedPrimaryHit(PrimaryHitRecord record, float3 origin, float3 rayDir)
+{
+	if (record.geometryID == PRIMARY_HIT_CACHE_MISS)
+	{
+		return MissColor();
+	}
+
+	PerGeometryConstantBuffer geometry = PerGeometryConstants[record.geometryID];
+
+	HitInfo hit;
+	hit.position = origin + record.t * rayDir;
+	hit.rayDirection = rayDir;
+	hit.barycentrics = record.barycentrics;
+	hit.primitiveIndex = record.primitiveIndex;
+	hit.geometryID = geometry.geometryID;
+	hit.indexBufferOffset = geometry.indexBufferOffset;
+	hit.albedo = geometry.albedo;
+	// The scene is one instance with an identity transform, see VaporPlus::BuildAccelerationStructures.
+	hit.objectToWorld = float3x3(1, 0, 0, 0, 1, 0, 0, 0, 1);
+	hit.coneWidth = record.t * g_sceneCB.pixelSpreadAngle;
+
+	// Branch on the material so each case shades exactly like the closest hit shader for it.
+	switch (geometry.material)
+	{
+	case CHECKERBOARD_FLOOR_MATERIAL: return ShadeHit(hit, CHECKERBOARD_FLOOR_MATERIAL);
+	case STATUE_MATERIAL: return ShadeHit(hit, STATUE_MATERIAL);
+	case CITYSCAPE_MATERIAL: return ShadeHit(hit, CITYSCAPE_MATERIAL);
+	default: return ShadeHit(hit, TEXT_MATERIAL);
+	}
 }
 
 [shader("raygeneration")]
@@ -121,9 +332,25 @@ void MyRaygenShader()
 {
     float3 rayDir;
     float3 origin;
+
+    uint2 outputSize = GetRaytracingSize();
+
+    // Edge tiles can hang off the right and bottom of the screen.
+    uint2 pixel = GetDispatchPixel();
+    if (any(pixel >= outputSize))
+    {
+        return;
+    }
     
-    // Generate a ray for a camera pixel corresponding to an index from the dispatched 2D grid.
-    GenerateCameraRay(DispatchRaysIndex().xy, origin, rayDir);
+    // Generate a ray for the camera pixel this dispatch index maps to.
+    GenerateCameraRay(pixel, origin, rayDir);
+
+    // Reuse the cached primary hit when nothing that moved can be under this pixel; only shading runs again.
+    if (g_sceneCB.primaryHitCacheValid && !IsInPrimaryHitCacheRetraceRect(pixel))
+    {
+        RenderTarget[pixel] = ShadeCachedPrimaryHit(PrimaryHitCache[GetPrimaryHitCacheIndex(pixel)], origin, rayDir);
+        return;
+    }
 
     // Trace the ray.
     // Set the ray's extents.
@@ -157,19 +384,124 @@ void MyRaygenShader()
 	*/
 
     // Write the raytraced color to the output texture.
-    RenderTarget[DispatchRaysIndex().xy] = payload.color;
+    RenderTarget[pixel] = payload.color;
 }
 
-[shader("closesthit")]
-void MyClosestHitShader(inout RayPayload payload, in MyAttributes attr)
+// Fill in the checkerboard pixels that weren't traced this frame. Each dispatch row is a pixel row, and each
+// index along it one untraced pixel.
+[shader("raygeneration")]
+void MyCheckerboardResolveShader()
+{
+	uint2 index = DispatchRaysIndex().xy;
+	uint2 pixel = uint2(index.x * 2 + ((index.y + g_sceneCB.checkerboardParity + 1) & 1), index.y);
+
+	uint2 size = GetRaytracingSize();
+	if (any(pixel >= size))
+	{
+		return;
+	}
+
+	// The camera is fixed, so away from the moving objects the color traced here last frame can still hold. The
+	// primary hit cache's retrace rects bound everywhere those objects were this frame and last. The floor doesn't
+	// hold still though: its texture scrolls every frame and the objects' shadows cross it, so pixels whose cache
+	// record, written when they were last traced, shows the floor are filled in like the rest.
+	if (g_sceneCB.checkerboardHistoryValid && !IsInPrimaryHitCacheRetraceRect(pixel))
+	{
+		PrimaryHitRecord record = PrimaryHitCache[GetPrimaryHitCacheIndex(pixel)];
+		if (record.geometryID == PRIMARY_HIT_CACHE_MISS || PerGeometryConstants[record.geometryID].material != CHECKERBOARD_FLOOR_MATERIAL)
+		{
+			return;
+		}
+	}
+
+	// Elsewhere, average the neighbors traced this frame. This is spatial interpolation only: last frame's color isn't
+	// reprojected along the objects' motion, so these pixels get half the detail.
+	float4 sum = float4(0, 0, 0, 0);
+	float count = 0;
+	if (pixel.x > 0)
+	{
+		sum += RenderTarget[pixel - uint2(1, 0)];
+		count += 1;
+	}
+	if (pixel.x + 1 < size.x)
+	{
+		sum += RenderTarget[pixel + uint2(1, 0)];
+		count += 1;
+	}
+	if (pixel.y > 0)
+	{
+		sum += RenderTarget[pixel - uint2(0, 1)];
+		count += 1;
+	}
+	if (pixel.y + 1 < size.y)
+	{
+		sum += RenderTarget[pixel + uint2(0, 1)];
+		count += 1;
+	}
+	RenderTarget[pixel] = sum / max(count, 1);
+}
+
+// Fill in the pixels a progressive pass didn't trace with the traced pixel at the top left of their square.
+[shader("raygeneration")]
+void MyProgressiveFillShader()
+{
+	uint2 pixel = DispatchRaysIndex().xy;
+	uint2 anchor = pixel - pixel % g_sceneCB.progressiveStride;
+
+	if (any(pixel >= GetRaytracingSize()) || all(pixel == anchor))
+	{
+		return;
+	}
+	RenderTarget[pixel] = RenderTarget[anchor];
+}
+
+// Ray cone texture LOD: the mip level at which a texel is as wide as the cone where it meets the triangle. The
+// triangle's texel to world area ratio gives the texel size, and the cone's footprint grows as the hit gets more
+// grazing. Levels count from the full size texture, of which tex holds residentMip onwards.
+float GetTextureLod(Texture2D<float4> tex, uint residentMip, HitInfo hit, float3 positions[3], float3 uvs[3], float3 normal)
+{
+	uint width, height, mipLevels;
+	tex.GetDimensions(0, width, height, mipLevels);
+	width <<= residentMip;
+	height <<= residentMip;
+
+	float2 texelEdge1 = (uvs[1].xy - uvs[0].xy) * float2(width, height);
+	float2 texelEdge2 = (uvs[2].xy - uvs[0].xy) * float2(width, height);
+	float texelArea = abs(texelEdge1.x * texelEdge2.y - texelEdge1.y * texelEdge2.x);
+
+	float3x3 geometryTransform = (float3x3)g_sceneCB.perGeometryTransform[hit.geometryID];
+	float3 worldEdge1 = mul(hit.objectToWorld, mul(positions[1] - positions[0], geometryTransform));
+	float3 worldEdge2 = mul(hit.objectToWorld, mul(positions[2] - positions[0], geometryTransform));
+	float worldArea = length(cross(worldEdge1, worldEdge2));
+
+	float cosine = max(abs(dot(normal, hit.rayDirection)), 1e-4f);
+	return 0.5f * log2(texelArea / max(worldArea, 1e-12f)) + log2(hit.coneWidth / cosine);
+}
+
+// Lower the finest mip level recorded for a streamed texture. One atomic per wave rather than per sample.
+void RecordTextureFeedback(uint offset, float lod)
+{
+	if (!g_sceneCB.textureStreamingEnabled)
+		return;
+
+	uint level = WaveActiveMin(uint(max(lod, 0.0f)));
+	if (WaveIsFirstLane())
+	{
+		uint previous;
+		TextureFeedback.InterlockedMin(offset, level, previous);
+	}
+}
+
+// Shading shared by all closest hit shaders and cached primary hits. materialIndex must be a compile-time constant.
+float4 ShadeHit(HitInfo hit, uint materialIndex)
 {
-    float3 hitPosition = HitWorldPosition();
+    float3 hitPosition = hit.position;
 
     // Get the base index of the triangle's first 16 bit index.
     uint indexSizeInBytes = 2;
     uint indicesPerTriangle = 3;
     uint triangleIndexStride = indicesPerTriangle * indexSizeInBytes;
-	uint baseIndex = g_perGeometryCB.indexBufferOffset + (PrimitiveIndex() * triangleIndexStride);
+	uint baseIndex = hit.indexBufferOffset + (hit.primitiveIndex * triangleIndexStride);
 
     // Load up 3 16 bit indices for the triangle.
     const uint3 indices = Load3x16BitIndices(baseIndex);
@@ -184,38 +516,14 @@ void MyClosestHitShader(inout RayPayload payload, in MyAttributes attr)
     // Compute the triangle's normal.
     // This is redundant and done for illustration purposes 
     // as all the per-vertex normals are the same and match triangle's normal in this sample. 
-	float3 triangleNormal = HitAttribute(vertexNormals, attr);
-	triangleNormal = mul(triangleNormal, (float3x3)g_sceneCB.perGeometryTransform[g_perGeometryCB.geometryID]);
-	triangleNormal = normalize(mul((float3x3)ObjectToWorld(), triangleNormal));
+	float3 triangleNormal = HitAttribute(vertexNormals, hit.barycentrics);
+	triangleNormal = mul(triangleNormal, (float3x3)g_sceneCB.perGeometryTransform[hit.geometryID]);
+	triangleNormal = normalize(mul(hit.objectToWorld, triangleNormal));
 
 	float4 shadow = float4(1, 1, 1, 1);
-	
+	if (IsShadowed(hitPosition, triangleNormal, materialIndex))
 	{
-		ShadowRayPayload shadowPayload = { true }; // There's a miss shader to set this to false.
-
-		// Trace shadow ray
-		RayDesc rayDesc;
-		rayDesc.Origin = hitPosition;
-		rayDesc.Direction = normalize(g_sceneCB.lightPosition.xyz - hitPosition);
-		rayDesc.TMin = 0.001;
-		rayDesc.TMax = 10000.0;
-		
-		TraceRay(Scene,
-			RAY_FLAG_CULL_BACK_FACING_TRIANGLES
-			| RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH
-			| RAY_FLAG_FORCE_OPAQUE
-			| RAY_FLAG_SKIP_CLOSEST_HIT_SHADER, // We're not running closest hit
-			~0, // Mask
-			1, // RayContributionToHitGroupIndex,
-			0, // MultiplierForGeometryContributionToHitGroupIndex, 
-			1, // Miss shader index
-			rayDesc,
-			shadowPayload);
-
-		if (shadowPayload.hit)
-		{
-			shadow = float4(0.8f, 0.7f, 0.7f, 1.0f);
-		}
+		shadow = float4(0.8f, 0.7f, 0.7f, 1.0f);
 	}
 	
 	float3 uvs[3] = {
@@ -223,63 +531,128 @@ void MyClosestHitShader(inout RayPayload payload, in MyAttributes attr)
 		Vertices[indices[1]].uv,
 		Vertices[indices[2]].uv
 	};
-	float3 uv = HitAttribute(uvs, attr);
+	float3 uv = HitAttribute(uvs, hit.barycentrics);
 
-	uint materialIndex = g_perGeometryCB.material;
+	float3 positions[3] = {
+		Vertices[indices[0]].position,
+		Vertices[indices[1]].position,
+		Vertices[indices[2]].position
+	};
 
 	float3 incidentLightRay = normalize(hitPosition - g_sceneCB.lightPosition.xyz);
 
 	float4 sampled = float4(1, 1, 1, 1);
-	float4 diffuseScale = float4(1, 1, 1, 1);
 	float4 specularColor = float4(0, 0, 0, 0);
-	float4 lightMaxing = float4(0, 0, 0, 0);
+	float4 lightMaxing = MaterialIsFullbright(materialIndex) ? float4(1, 1, 1, 1) : float4(0, 0, 0, 0);
 	
 	if (materialIndex == CHECKERBOARD_FLOOR_MATERIAL)
 	{
 		float2 dispUV = uv.xy;
 		dispUV.x += g_sceneCB.floorUVDisp.x;
 		dispUV.y += g_sceneCB.floorUVDisp.y;
-		sampled = CheckerboardTexture.SampleLevel(TextureSampler, dispUV, 0);
-		lightMaxing = float4(1, 1, 1, 1);
+		float lod = GetTextureLod(CheckerboardTexture, g_sceneCB.checkerboardResidentMip, hit, positions, uvs, triangleNormal);
+		RecordTextureFeedback(TEXTURE_FEEDBACK_CHECKERBOARD_OFFSET, lod);
+		sampled = CheckerboardTexture.SampleLevel(TextureSampler, dispUV, max(lod - g_sceneCB.checkerboardResidentMip, 0.0f));
 	}
 	else if (materialIndex == STATUE_MATERIAL)
 	{
 		sampled = float4(0.8f, 0.8f, 0.75f, 1.0f);
-
-		float3 reflectedLightRay = normalize(reflect(incidentLightRay, triangleNormal));
-		float specularPower = 20;
-		float4 specularCoefficient = pow(saturate(dot(reflectedLightRay, normalize(-WorldRayDirection()))), specularPower) * 0.5f;
-		specularColor = specularCoefficient;
 	}
 	else if (materialIndex == CITYSCAPE_MATERIAL)
 	{
-		sampled = CityscapeTexture.SampleLevel(TextureSampler, uv.xy, 0);
+		float lod = GetTextureLod(CityscapeTexture, g_sceneCB.cityscapeResidentMip, hit, positions, uvs, triangleNormal);
+		RecordTextureFeedback(TEXTURE_FEEDBACK_CITYSCAPE_OFFSET, lod);
+		sampled = CityscapeTexture.SampleLevel(TextureSampler, uv.xy, max(lod - g_sceneCB.cityscapeResidentMip, 0.0f));
 	}
 	else if (materialIndex == TEXT_MATERIAL)
 	{
+		// Drawn into by Direct2D whenever the stats change, so it has no mip levels.
 		sampled = TextTexture.SampleLevel(TextureSampler, uv.xy, 0);
-		lightMaxing = float4(1, 1, 1, 1);
 	}
-	else
+
+	if (MaterialHasSpecular(materialIndex))
 	{
-		payload.color = float4(1, 1, 1, 1);
+		float3 reflectedLightRay = normalize(reflect(incidentLightRay, triangleNormal));
+		float specularPower = 20;
+		float4 specularCoefficient = pow(saturate(dot(reflectedLightRay, normalize(-hit.rayDirection))), specularPower) * 0.5f;
+		specularColor = specularCoefficient;
 	}
 
-	float4 diffuseColor = CalculateDiffuseLighting(incidentLightRay, triangleNormal, g_sceneCB.lightDiffuseColor);
+	float4 diffuseColor = CalculateDiffuseLighting(incidentLightRay, triangleNormal, g_sceneCB.lightDiffuseColor, hit.albedo);
 
 	float4 lightColor = g_sceneCB.lightAmbientColor + diffuseColor + specularColor;
 	lightColor = max(lightColor, lightMaxing);
 
 	float4 finalColor = lightColor * sampled * shadow;
 
-	payload.color = finalColor;
+	return finalColor;
+}
+
+void ShadeClosestHit(inout RayPayload payload, in MyAttributes attr, uint materialIndex)
+{
+	HitInfo hit;
+	hit.position = HitWorldPosition();
+	hit.rayDirection = WorldRayDirection();
+	hit.barycentrics = attr.barycentrics;
+	hit.primitiveIndex = PrimitiveIndex();
+	hit.geometryID = g_perGeometryCB.geometryID;
+	hit.indexBufferOffset = g_perGeometryCB.indexBufferOffset;
+	hit.albedo = g_perGeometryCB.albedo;
+	hit.objectToWorld = (float3x3)ObjectToWorld();
+	hit.coneWidth = RayTCurrent() * g_sceneCB.pixelSpreadAngle;
+
+	// Shadow rays skip closest hit shaders, so this is always the primary hit for the dispatch pixel.
+	if (g_sceneCB.primaryHitRecordsEnabled)
+	{
+		PrimaryHitRecord record;
+		record.geometryID = g_perGeometryCB.geometryID;
+		record.primitiveIndex = PrimitiveIndex();
+		record.barycentrics = attr.barycentrics;
+		record.t = RayTCurrent();
+		PrimaryHitCache[GetPrimaryHitCacheIndex(GetDispatchPixel())] = record;
+	}
+
+	payload.color = ShadeHit(hit, materialIndex);
+}
+
+[shader("closesthit")]
+void MyClosestHitShader_Floor(inout RayPayload payload, in MyAttributes attr)
+{
+	ShadeClosestHit(payload, attr, CHECKERBOARD_FLOOR_MATERIAL);
+}
+
+[shader("closesthit")]
+void MyClosestHitShader_Statue(inout RayPayload payload, in MyAttributes attr)
+{
+	ShadeClosestHit(payload, attr, STATUE_MATERIAL);
+}
+
+[shader("closesthit")]
+void MyClosestHitShader_Cityscape(inout RayPayload payload, in MyAttributes attr)
+{
+	ShadeClosestHit(payload, attr, CITYSCAPE_MATERIAL);
+}
+
+[shader("closesthit")]
+void MyClosestHitShader_Text(inout RayPayload payload, in MyAttributes attr)
+{
+	ShadeClosestHit(payload, attr, TEXT_MATERIAL);
 }
 
 [shader("miss")]
 void MyMissShader(inout RayPayload payload)
 {
-	float4 pank = float4(1.0f, 0.51, 0.61f, 1.0f);
-    payload.color = pank;
+	if (g_sceneCB.primaryHitRecordsEnabled)
+	{
+		PrimaryHitRecord record;
+		record.geometryID = PRIMARY_HIT_CACHE_MISS;
+		record.primitiveIndex = 0;
+		record.barycentrics = float2(0, 0);
+		record.t = 0;
+		PrimaryHitCache[GetPrimaryHitCacheIndex(GetDispatchPixel())] = record;
+	}
+
+    payload.color = MissColor();
 }
 
 [shader("miss")]
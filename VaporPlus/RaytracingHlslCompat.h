@@ -10,17 +10,55 @@ using namespace DirectX;
 typedef UINT16 Index;
 #endif
 
+// One retrace rectangle per moving object: the statue, the cityscape and the text.
+#define PRIMARY_HIT_CACHE_RETRACE_RECT_COUNT 3
+
 struct SceneConstantBuffer
 {
     XMMATRIX projectionToWorld;
     XMVECTOR cameraPosition;
+    XMVECTOR cameraRayTopLeft;          // Unnormalized direction through the center of pixel (0, 0)
+    XMVECTOR cameraRayPixelDeltaX;      // Change in that direction per pixel to the right
+    XMVECTOR cameraRayPixelDeltaY;      // Change in that direction per pixel down
     XMVECTOR lightPosition;
     XMVECTOR lightAmbientColor;
     XMVECTOR lightDiffuseColor;
 
 	XMMATRIX perGeometryTransform[4];
 
+	XMFLOAT4 primaryHitCacheRetraceRects[PRIMARY_HIT_CACHE_RETRACE_RECT_COUNT]; // Pixel bounds: min x, min y, max x, max y (exclusive)
+
+	XMFLOAT4 floorShadowCacheBounds; // World bounds of the floor's top face: min x, min z, max x, max z
+
 	XMFLOAT3 floorUVDisp;
+	uint32_t primaryHitCacheValid;
+
+	// Primary hits are only recorded while the hit cache or the checkerboard resolve will read them
+	uint32_t primaryHitRecordsEnabled;
+
+	uint32_t floorShadowCacheEnabled;
+
+	// Size of the part of the output that's traced, see VaporPlus::UpdateRaytracingResolution
+	uint32_t raytracingWidth;
+	uint32_t raytracingHeight;
+
+	// Checkerboard rendering traces the pixels with (x + y) % 2 == checkerboardParity, alternating each frame
+	uint32_t checkerboardEnabled;
+	uint32_t checkerboardParity;
+	uint32_t checkerboardHistoryValid;
+
+	// Progressive refinement traces one pixel per progressiveStride square and fills in the rest. 1 traces every pixel.
+	uint32_t progressiveStride;
+
+	// Angle a ray cone through one pixel widens by, for picking texture mip levels
+	float pixelSpreadAngle;
+
+	// Finest mip level of each streamed texture that the GPU holds, which is level 0 of its SRV
+	uint32_t checkerboardResidentMip;
+	uint32_t cityscapeResidentMip;
+
+	// Set with -textureBudget. Without it nothing is streamed and shading records no texture feedback.
+	uint32_t textureStreamingEnabled;
 };
 
 struct PerGeometryConstantBuffer
@@ -31,6 +69,40 @@ struct PerGeometryConstantBuffer
 	uint32_t geometryID;
 };
 
+// What a primary ray hit, recorded per pixel so later frames can reshade it without tracing again.
+struct PrimaryHitRecord
+{
+	uint32_t geometryID; // PRIMARY_HIT_CACHE_MISS if the ray hit nothing
+	uint32_t primitiveIndex;
+	XMFLOAT2 barycentrics;
+	float t;
+};
+
+#define PRIMARY_HIT_CACHE_MISS 0xffffffff
+
+// Floor shadow cache texels, over the floor's top face. Cleared texels read as unknown.
+#define FLOOR_SHADOW_CACHE_WIDTH 2048
+#define FLOOR_SHADOW_CACHE_HEIGHT 1024
+#define FLOOR_SHADOW_CACHE_UNKNOWN 0
+#define FLOOR_SHADOW_CACHE_LIT 1
+#define FLOOR_SHADOW_CACHE_SHADOWED 2
+
+// Running totals of shadow rays, as byte offsets into the shadow ray stats buffer.
+#define SHADOW_RAY_STATS_TRACED_OFFSET 0
+#define SHADOW_RAY_STATS_CACHED_OFFSET 4
+#define SHADOW_RAY_STATS_SIZE 8
+
+// Finest mip level each streamed texture was sampled at in a frame, as byte offsets into the texture feedback buffer.
+// Levels count from the full size texture, whatever is resident.
+#define TEXTURE_FEEDBACK_CHECKERBOARD_OFFSET 0
+#define TEXTURE_FEEDBACK_CITYSCAPE_OFFSET 4
+#define TEXTURE_FEEDBACK_SIZE 8
+#define TEXTURE_FEEDBACK_NOT_SAMPLED 0xffffffff
+
+// Offset of the postprocess blur taps, in UV units. VaporPlus::GetRaytracingResolutionDivisor picks the ray tracing
+// resolution from it.
+#define POSTPROCESS_BLUR_OFFSET 0.00065f
+
 struct Vertex
 {
     XMFLOAT3 position;
@@ -42,6 +114,10 @@ struct Vertex
 #define STATUE_MATERIAL 2
 #define CITYSCAPE_MATERIAL 3
 #define TEXT_MATERIAL 4
+#define MATERIAL_COUNT 4
+
+// Primary rays are dispatched as one RAYGEN_TILE_SIZE x RAYGEN_TILE_SIZE tile per DispatchRays row.
+#define RAYGEN_TILE_SIZE 8
 
 enum TextureIdentifier
 {
@@ -0,0 +1,283 @@
+#include "stdafx.h"
+#include "TaskPool.h"
+
+// Which pool's deque the current thread owns, if any
+static thread_local TaskPool const* t_currentPool = nullptr;
+static thread_local UINT t_workerIndex = 0;
+
+bool TaskPool::WorkDeque::Push(Task* task)
+{
+	int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+	int64_t top = m_top.load(std::memory_order_acquire);
+	if (bottom - top >= Capacity)
+		return false;
+
+	m_buffer[bottom % Capacity].store(task, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	m_bottom.store(bottom + 1, std::memory_order_relaxed);
+	return true;
+}
+
+TaskPool::Task* TaskPool::WorkDeque::Pop()
+{
+	int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+	m_bottom.store(bottom, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t top = m_top.load(std::memory_order_relaxed);
+
+	if (top > bottom)
+	{
+		// Empty
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Task* task = m_buffer[bottom % Capacity].load(std::memory_order_relaxed);
+	if (top == bottom)
+	{
+		// The last task. Race thieves for it.
+		if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			task = nullptr;
+		}
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+	}
+	return task;
+}
+
+TaskPool::Task* TaskPool::WorkDeque::Steal()
+{
+	int64_t top = m_top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t bottom = m_bottom.load(std::memory_order_acquire);
+
+	if (top >= bottom)
+		return nullptr;
+
+	Task* task = m_buffer[top % Capacity].load(std::memory_order_relaxed);
+	if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return nullptr; // Lost to the owner or another thief
+
+	return task;
+}
+
+TaskPool::TaskPool(UINT workerThreadCount)
+{
+	QueryPerformanceFrequency(&m_performanceFrequency);
+
+	if (workerThreadCount == UINT_MAX)
+	{
+		workerThreadCount = max(std::thread::hardware_concurrency(), 2u) - 1;
+	}
+
+	for (UINT i = 0; i < workerThreadCount + 1; ++i)
+	{
+		m_workers.push_back(std::make_unique<Worker>());
+	}
+
+	t_currentPool = this;
+	t_workerIndex = 0;
+
+	for (UINT i = 1; i < workerThreadCount + 1; ++i)
+	{
+		m_threads.emplace_back(&TaskPool::WorkerMain, this, i);
+	}
+}
+
+TaskPool::~TaskPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_wakeMutex);
+		m_shutdown = true;
+	}
+	m_wakeCondition.notify_all();
+
+	for (auto& thread : m_threads)
+	{
+		thread.join();
+	}
+
+	if (t_currentPool == this)
+	{
+		t_currentPool = nullptr;
+	}
+}
+
+UINT TaskPool::GetCurrentWorkerIndex() const
+{
+	ThrowIfFalse(t_currentPool == this, L"Tasks can only be spawned from the thread that created the pool or from tasks.");
+	return t_workerIndex;
+}
+
+void TaskPool::Run(TaskGroup* group, std::function<void()> function)
+{
+	UINT workerIndex = GetCurrentWorkerIndex();
+
+	Task* task = new Task{ std::move(function), group };
+	group->m_pendingCount.fetch_add(1, std::memory_order_relaxed);
+
+	if (!m_workers[workerIndex]->Deque.Push(task))
+	{
+		// The deque is full, so there's already plenty to steal.
+		Execute(task, workerIndex);
+		return;
+	}
+
+	m_queuedCount.fetch_add(1);
+	if (m_sleepingCount.load() > 0)
+	{
+		std::lock_guard<std::mutex> lock(m_wakeMutex);
+		m_wakeCondition.notify_one();
+	}
+}
+
+void TaskPool::Wait(TaskGroup* group)
+{
+	UINT workerIndex = GetCurrentWorkerIndex();
+
+	// Help out rather than block. Tasks of this group may be running elsewhere, with nothing left to take.
+	while (group->m_pendingCount.load(std::memory_order_acquire) > 0)
+	{
+		Task* task = FindTask(workerIndex);
+		if (task)
+		{
+			Execute(task, workerIndex);
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	if (group->m_exception)
+	{
+		std::exception_ptr exception = group->m_exception;
+		group->m_exception = nullptr;
+		std::rethrow_exception(exception);
+	}
+}
+
+void TaskPool::ParallelFor(UINT begin, UINT end, UINT grainSize, std::function<void(UINT, UINT)> const& body)
+{
+	if (begin >= end)
+		return;
+
+	grainSize = max(grainSize, 1u);
+	if (end - begin <= grainSize || m_threads.empty())
+	{
+		body(begin, end);
+		return;
+	}
+
+	TaskGroup group;
+	for (UINT chunkBegin = begin; chunkBegin < end; chunkBegin += min(grainSize, end - chunkBegin))
+	{
+		UINT chunkEnd = chunkBegin + min(grainSize, end - chunkBegin);
+		Run(&group, [&body, chunkBegin, chunkEnd]() { body(chunkBegin, chunkEnd); });
+	}
+	Wait(&group);
+}
+
+// Own deque first, newest task first for locality. Then the oldest task of another thread, which tends to be the
+// biggest piece of work it has.
+TaskPool::Task* TaskPool::FindTask(UINT workerIndex)
+{
+	Worker& worker = *m_workers[workerIndex];
+
+	Task* task = worker.Deque.Pop();
+	if (!task)
+	{
+		UINT workerCount = GetThreadCount();
+		for (UINT i = 1; i < workerCount && !task; ++i)
+		{
+			task = m_workers[(workerIndex + i) % workerCount]->Deque.Steal();
+		}
+		if (task)
+		{
+			worker.Steals.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	if (task)
+	{
+		m_queuedCount.fetch_sub(1);
+	}
+	return task;
+}
+
+void TaskPool::Execute(Task* task, UINT workerIndex)
+{
+	TaskGroup* group = task->Group;
+	try
+	{
+		task->Function();
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(group->m_exceptionMutex);
+		if (!group->m_exception)
+		{
+			group->m_exception = std::current_exception();
+		}
+	}
+	delete task;
+
+	m_workers[workerIndex]->TasksRun.fetch_add(1, std::memory_order_relaxed);
+	group->m_pendingCount.fetch_sub(1, std::memory_order_release);
+}
+
+void TaskPool::WorkerMain(UINT workerIndex)
+{
+	t_currentPool = this;
+	t_workerIndex = workerIndex;
+	Worker& worker = *m_workers[workerIndex];
+
+	while (true)
+	{
+		Task* task = FindTask(workerIndex);
+		if (task)
+		{
+			Execute(task, workerIndex);
+			continue;
+		}
+
+		LARGE_INTEGER idleStart;
+		QueryPerformanceCounter(&idleStart);
+		{
+			std::unique_lock<std::mutex> lock(m_wakeMutex);
+			m_sleepingCount.fetch_add(1);
+			m_wakeCondition.wait(lock, [this]() { return m_shutdown.load() || m_queuedCount.load() > 0; });
+			m_sleepingCount.fetch_sub(1);
+		}
+		LARGE_INTEGER idleEnd;
+		QueryPerformanceCounter(&idleEnd);
+		worker.IdleTicks.fetch_add(idleEnd.QuadPart - idleStart.QuadPart, std::memory_order_relaxed);
+
+		if (m_shutdown.load())
+			return;
+	}
+}
+
+TaskPool::Stats TaskPool::GetStats() const
+{
+	Stats stats = {};
+	INT64 idleTicks = 0;
+	for (auto const& worker : m_workers)
+	{
+		stats.TasksRun += worker->TasksRun.load(std::memory_order_relaxed);
+		stats.Steals += worker->Steals.load(std::memory_order_relaxed);
+		idleTicks += worker->IdleTicks.load(std::memory_order_relaxed);
+	}
+	stats.IdleMs = static_cast<double>(idleTicks) * 1000.0 / static_cast<double>(m_performanceFrequency.QuadPart);
+	return stats;
+}
+
+void TaskPool::ResetStats()
+{
+	for (auto& worker : m_workers)
+	{
+		worker->TasksRun = 0;
+		worker->Steals = 0;
+		worker->IdleTicks = 0;
+	}
+}
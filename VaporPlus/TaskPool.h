@@ -0,0 +1,87 @@
+#pragma once
+
+// Worker threads running tasks from per-thread work-stealing deques. Tasks are spawned into a TaskGroup and joined
+// with Wait, which runs queued tasks rather than blocking. Tasks may be spawned by the thread that created the pool
+// and by running tasks.
+class TaskPool
+{
+public:
+	class TaskGroup
+	{
+		friend class TaskPool;
+
+		std::atomic<UINT> m_pendingCount{ 0 };
+		std::mutex m_exceptionMutex;
+		std::exception_ptr m_exception; // The first exception thrown by a task, rethrown by Wait
+	};
+
+	struct Stats
+	{
+		UINT64 TasksRun;
+		UINT64 Steals;
+		double IdleMs; // Summed over the worker threads
+	};
+
+	// By default there is one worker thread per hardware thread, besides the creating thread.
+	explicit TaskPool(UINT workerThreadCount = UINT_MAX);
+	~TaskPool();
+
+	void Run(TaskGroup* group, std::function<void()> function);
+	void Wait(TaskGroup* group);
+
+	// Calls body(chunkBegin, chunkEnd) over [begin, end) in chunks of up to grainSize, and returns once all are done.
+	void ParallelFor(UINT begin, UINT end, UINT grainSize, std::function<void(UINT, UINT)> const& body);
+
+	UINT GetThreadCount() const { return static_cast<UINT>(m_workers.size()); }
+	Stats GetStats() const;
+	void ResetStats();
+
+private:
+	struct Task
+	{
+		std::function<void()> Function;
+		TaskGroup* Group;
+	};
+
+	// Chase-Lev deque with a fixed capacity. The owning thread pushes and pops at the bottom, and other threads
+	// steal from the top.
+	class WorkDeque
+	{
+		static const int64_t Capacity = 4096;
+
+		std::atomic<int64_t> m_top{ 0 };
+		std::atomic<int64_t> m_bottom{ 0 };
+		std::atomic<Task*> m_buffer[Capacity];
+
+	public:
+		bool Push(Task* task);
+		Task* Pop();
+		Task* Steal();
+	};
+
+	// Index 0 belongs to the creating thread, which has a deque but no thread of its own.
+	struct Worker
+	{
+		WorkDeque Deque;
+		std::atomic<UINT64> TasksRun{ 0 };
+		std::atomic<UINT64> Steals{ 0 };
+		std::atomic<INT64> IdleTicks{ 0 };
+	};
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	std::vector<std::thread> m_threads;
+
+	// Sleeping workers are woken when tasks are queued. The counts are checked on both sides without the lock,
+	// so a spawn only takes it when someone is asleep.
+	std::atomic<UINT> m_queuedCount{ 0 };
+	std::atomic<UINT> m_sleepingCount{ 0 };
+	std::atomic<bool> m_shutdown{ false };
+	std::mutex m_wakeMutex;
+	std::condition_variable m_wakeCondition;
+
+	LARGE_INTEGER m_performanceFrequency;
+
+	void WorkerMain(UINT workerIndex);
+	UINT GetCurrentWorkerIndex() const;
+	Task* FindTask(UINT workerIndex);
+	void Execute(Task* task, UINT workerIndex);
+};
@@ -1,23 +1,62 @@
 ﻿#include "stdafx.h"
 #include "VaporPlus.h"
 #include "DirectXRaytracingHelper.h"
+#include "PixelFormat.h"
+#include "BlockCompression.h"
 #include "CompiledShaders\Raytracing.hlsl.h"
 
 using namespace DX;
 
-const wchar_t* VaporPlus::c_hitGroupName = L"MyHitGroup";
+// Hit group and closest hit shader names are indexed by material - 1.
+const wchar_t* VaporPlus::c_hitGroupNames[MATERIAL_COUNT] = { L"MyHitGroup_Floor", L"MyHitGroup_Statue", L"MyHitGroup_Cityscape", L"MyHitGroup_Text" };
 const wchar_t* VaporPlus::c_raygenShaderName = L"MyRaygenShader";
-const wchar_t* VaporPlus::c_closestHitShaderName = L"MyClosestHitShader";
+const wchar_t* VaporPlus::c_checkerboardResolveShaderName = L"MyCheckerboardResolveShader";
+const wchar_t* VaporPlus::c_progressiveFillShaderName = L"MyProgressiveFillShader";
+const wchar_t* VaporPlus::c_closestHitShaderNames[MATERIAL_COUNT] = { L"MyClosestHitShader_Floor", L"MyClosestHitShader_Statue", L"MyClosestHitShader_Cityscape", L"MyClosestHitShader_Text" };
 const wchar_t* VaporPlus::c_missShaderName = L"MyMissShader";
 const wchar_t* VaporPlus::c_missShaderName_Shadow = L"MyMissShader_ShadowRay";
 
 VaporPlus::VaporPlus(UINT width, UINT height, std::wstring name) :
     DXSample(width, height, name),
 	m_raytracingOutputResourceUAVDescriptorHeapIndexDuringRaytracing(UINT_MAX)
+	, m_raytracingWidth(width)
+	, m_raytracingHeight(height)
+	, m_enableResolutionGovernor(false)
+	, m_targetFrameTimeMs(1000.0f / 60.0f)
+	, m_smoothedFrameTimeMs(0.0f)
+	, m_resolutionScale(1.0f)
+	, m_framesSinceResolutionChange(0)
+	, m_enableProgressiveRefinement(false)
+	, m_progressivePass(ProgressivePassCount)
+	, m_progressiveStartTime{}
+	, m_progressiveFirstImageMs(0.0f)
+	, m_progressiveFinalImageMs(0.0f)
+	, m_primaryHitCacheFilledParities(0)
+	, m_retracedPixelFraction(1.0f)
+	, m_floorShadowCacheCleared(false)
+	, m_mappedShadowRayStats(nullptr)
+	, m_shadowRayStatsPending{}
+	, m_shadowRayTotals{}
+	, m_shadowRaysTraced(0)
+	, m_shadowRaysCached(0)
 	, m_curRotationAngleRad(0.0f)
 	, m_isDxrSupported(false)
 	, m_enableTextFrame(false)
 	, m_enablePostprocess(false)
+	, m_maxFrameLatency(1)
+	, m_inputPending(false)
+	, m_inputTime{}
+	, m_inputFenceValue(0)
+	, m_inputLatencyMs(0.0f)
+	, m_framesInFlight(FrameCount)
+	, m_frameTimings{}
+	, m_frameLatencyMs(0.0f)
+	, m_compressTextures(false)
+	, m_streamedTextures{}
+	, m_textureBudgetBytes(UINT64_MAX)
+	, m_textureResidentBytes(0)
+	, m_textureResidencyChanges(0)
+	, m_mappedTextureFeedback(nullptr)
 {
     UpdateForSizeChange(width, height);
 
@@ -38,6 +77,8 @@ void VaporPlus::OnInit()
         m_adapterIDoverride
         );
     m_deviceResources->RegisterDeviceNotify(this);
+    m_deviceResources->SetMaximumFrameLatency(m_maxFrameLatency);
+    m_deviceResources->SetMaxFramesInFlight(m_framesInFlight);
     m_deviceResources->SetWindow(Win32Application::GetHwnd(), m_width, m_height);
     m_deviceResources->InitializeDXGIAdapter();
 
@@ -61,12 +102,33 @@ void VaporPlus::UpdateCameraMatrices()
     XMMATRIX proj = XMMatrixPerspectiveFovLH(XMConvertToRadians(fovAngleY), m_aspectRatio, 1.0f, 125.0f);
     XMMATRIX viewProj = view * proj;
 
+    m_viewProj = viewProj;
+    m_sceneCB[frameIndex].raytracingWidth = m_raytracingWidth;
+    m_sceneCB[frameIndex].raytracingHeight = m_raytracingHeight;
     m_sceneCB[frameIndex].projectionToWorld = XMMatrixInverse(nullptr, viewProj);
 
-	m_sceneCB[frameIndex].perGeometryTransform[0] = m_floor.GetTransform();
-	m_sceneCB[frameIndex].perGeometryTransform[1] = m_helios.GetTransform();
-	m_sceneCB[frameIndex].perGeometryTransform[2] = m_cityscape.GetTransform();
-	m_sceneCB[frameIndex].perGeometryTransform[3] = m_text.GetTransform();
+	// Precompute the camera ray through the first pixel center and how it changes per pixel. The deltas are
+	// taken across the whole screen rather than across one pixel, to keep rounding error from accumulating.
+	{
+		XMMATRIX projectionToWorld = m_sceneCB[frameIndex].projectionToWorld;
+		float width = static_cast<float>(m_raytracingWidth);
+		float height = static_cast<float>(m_raytracingHeight);
+
+		auto UnprojectPixel = [&](float x, float y)
+		{
+			XMVECTOR screenPos = XMVectorSet(x / width * 2.0f - 1.0f, 1.0f - y / height * 2.0f, 0.0f, 1.0f);
+			return XMVector3TransformCoord(screenPos, projectionToWorld);
+		};
+
+		XMVECTOR topLeft = UnprojectPixel(0.5f, 0.5f);
+		XMVECTOR topRight = UnprojectPixel(width - 0.5f, 0.5f);
+		XMVECTOR bottomLeft = UnprojectPixel(0.5f, height - 0.5f);
+
+		m_sceneCB[frameIndex].cameraRayTopLeft = XMVectorSetW(topLeft - m_eye, 0.0f);
+		m_sceneCB[frameIndex].cameraRayPixelDeltaX = XMVectorSetW((topRight - topLeft) / max(width - 1.0f, 1.0f), 0.0f);
+		m_sceneCB[frameIndex].cameraRayPixelDeltaY = XMVectorSetW((bottomLeft - topLeft) / max(height - 1.0f, 1.0f), 0.0f);
+		m_sceneCB[frameIndex].pixelSpreadAngle = atanf(2.0f * tanf(XMConvertToRadians(fovAngleY) * 0.5f) / height);
+	}
 
 	static const float floorAnimationXIncrement = 0.01f / 32.0f;
 	static const float floorAnimationYIncrement = 0.01f / 4.0f;
@@ -74,14 +136,12 @@ void VaporPlus::UpdateCameraMatrices()
 	m_sceneCB[frameIndex].floorUVDisp.x = m_floorTextureOffsetX;
 	m_sceneCB[frameIndex].floorUVDisp.y = m_floorTextureOffsetY;
 
+	// The sampler wraps, so only the fractional part of the offset matters. Keeping it in [0, 1) keeps the float's
+	// precision for it, where counting up to 1000 rounded each X step by up to a tenth and made the scroll uneven.
 	m_floorTextureOffsetX += floorAnimationXIncrement;
 	m_floorTextureOffsetY += floorAnimationYIncrement;
-
-	if (m_floorTextureOffsetX > 1000)
-		m_floorTextureOffsetX = 0;
-
-	if (m_floorTextureOffsetY > 1000)
-		m_floorTextureOffsetY = 0;
+	m_floorTextureOffsetX -= floorf(m_floorTextureOffsetX);
+	m_floorTextureOffsetY -= floorf(m_floorTextureOffsetY);
 }
 
 // Initialize scene rendering parameters.
@@ -193,13 +253,34 @@ void VaporPlus::CreateDeviceDependentResources()
     // Create a heap for descriptors.
     CreateDescriptorHeaps();
 
-	m_objLoader.Load(L"helios.obj");
+	// The worker threads are only needed for loading, so they're started here and stopped once it's done.
+	m_taskPool = std::make_unique<TaskPool>();
+
+	{
+		LARGE_INTEGER loadStart, loadEnd;
+		QueryPerformanceCounter(&loadStart);
+
+		m_objLoader.Load(L"helios.obj", m_taskPool.get());
+
+		QueryPerformanceCounter(&loadEnd);
+		TaskPool::Stats stats = m_taskPool->GetStats();
+		std::wstringstream message;
+		message << L"Loaded helios.obj in " << (loadEnd.QuadPart - loadStart.QuadPart) * 1000 / m_performanceFrequency.QuadPart << L" ms on "
+			<< m_taskPool->GetThreadCount() << L" threads: " << stats.TasksRun << L" tasks, " << stats.Steals << L" steals, "
+			<< stats.IdleMs << L" ms worker idle time\n";
+		OutputDebugStringW(message.str().c_str());
+	}
 
 	LoadTextures();
+	m_taskPool.reset();
 
     // Build geometry to be used in the sample.
     BuildGeometry();
 
+	// Needs the floor's bounds from BuildGeometry.
+	CreateFloorShadowCache();
+	CreateTextureFeedback();
+
     // Build raytracing acceleration structures from the generated geometry.
     BuildAccelerationStructures();
 
@@ -223,23 +304,26 @@ void VaporPlus::CreateRootSignatures()
     // Global Root Signature
     // This is a root signature that is shared across all raytracing shaders invoked during a DispatchRays() call.
     {
-		CD3DX12_DESCRIPTOR_RANGE ranges[6]; // Perfomance TIP: Order from most frequent to least frequent.
+		CD3DX12_DESCRIPTOR_RANGE ranges[5]; // Perfomance TIP: Order from most frequent to least frequent.
 		ranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0);  // 1 output texture
 		ranges[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 2, 1);  // 2 static index and vertex buffers.
-		ranges[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 3);  // a static input texture
+		ranges[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, MaterialTextureCount, 3);  // checkerboard, cityscape and text textures
 		ranges[3].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SAMPLER, 1, 0); // a sampler
-		ranges[4].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 4);  // a static input texture
-		ranges[5].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 5);  // a static input texture
+		ranges[4].Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 2);  // floor shadow cache
 
 		CD3DX12_ROOT_PARAMETER rootParameters[GlobalRootSignatureParams::Count]{};
         rootParameters[GlobalRootSignatureParams::OutputViewSlot].InitAsDescriptorTable(1, &ranges[0]);
         rootParameters[GlobalRootSignatureParams::AccelerationStructureSlot].InitAsShaderResourceView(0);
         rootParameters[GlobalRootSignatureParams::SceneConstantSlot].InitAsConstantBufferView(0);
         rootParameters[GlobalRootSignatureParams::VertexBuffersSlot].InitAsDescriptorTable(1, &ranges[1]);
-		rootParameters[GlobalRootSignatureParams::CheckerboardTextureSlot].InitAsDescriptorTable(1, &ranges[2]);
+		rootParameters[GlobalRootSignatureParams::MaterialTexturesSlot].InitAsDescriptorTable(1, &ranges[2]);
 		rootParameters[GlobalRootSignatureParams::SamplerSlot].InitAsDescriptorTable(1, &ranges[3]);
-		rootParameters[GlobalRootSignatureParams::CityscapeTextureSlot].InitAsDescriptorTable(1, &ranges[4]);
-		rootParameters[GlobalRootSignatureParams::TextTextureSlot].InitAsDescriptorTable(1, &ranges[5]);
+		rootParameters[GlobalRootSignatureParams::TileOrderSlot].InitAsShaderResourceView(6);
+		rootParameters[GlobalRootSignatureParams::PerGeometryConstantsSlot].InitAsShaderResourceView(7);
+		rootParameters[GlobalRootSignatureParams::PrimaryHitCacheSlot].InitAsUnorderedAccessView(1);
+		rootParameters[GlobalRootSignatureParams::FloorShadowCacheSlot].InitAsDescriptorTable(1, &ranges[4]);
+		rootParameters[GlobalRootSignatureParams::ShadowRayStatsSlot].InitAsUnorderedAccessView(3);
+		rootParameters[GlobalRootSignatureParams::TextureFeedbackSlot].InitAsUnorderedAccessView(4);
         CD3DX12_ROOT_SIGNATURE_DESC globalRootSignatureDesc(ARRAYSIZE(rootParameters), rootParameters);
 		SerializeAndCreateRootSignature(device, globalRootSignatureDesc, &m_raytracingGlobalRootSignature);
     }
@@ -280,7 +364,10 @@ void VaporPlus::CreateLocalRootSignatureSubobjects(CD3D12_STATE_OBJECT_DESC* ray
     {
         auto rootSignatureAssociation = raytracingPipeline->CreateSubobject<CD3D12_SUBOBJECT_TO_EXPORTS_ASSOCIATION_SUBOBJECT>();
         rootSignatureAssociation->SetSubobjectToAssociate(*localRootSignature);
-        rootSignatureAssociation->AddExport(c_hitGroupName);
+		for (const wchar_t* hitGroupName : c_hitGroupNames)
+		{
+			rootSignatureAssociation->AddExport(hitGroupName);
+		}
     }
 }
 
@@ -295,7 +382,7 @@ void VaporPlus::CreateRaytracingPipelineStateObject()
     // This simple sample utilizes default shader association except for local root signature subobject
     // which has an explicit association specified purely for demonstration purposes.
     // 1 - DXIL library
-    // 1 - Triangle hit group
+    // 4 - Triangle hit groups, one per material
     // 1 - Shader config
     // 2 - Local root signature and association
     // 1 - Global root signature
@@ -314,10 +401,12 @@ void VaporPlus::CreateRaytracingPipelineStateObject()
     // In this sample, this could be omitted for convenience since the sample uses all shaders in the library. 
     {
         lib->DefineExport(c_raygenShaderName);
-        lib->DefineExport(c_closestHitShaderName);
+        lib->DefineExport(c_checkerboardResolveShaderName);
+        lib->DefineExport(c_progressiveFillShaderName);
+        DefineExports(lib, c_closestHitShaderNames);
         lib->DefineExport(c_missShaderName);
 		lib->DefineExport(c_missShaderName_Shadow);
-		lib->DefineExport(c_hitGroupName);
+		DefineExports(lib, c_hitGroupNames);
     }
     
     // Shader config
@@ -378,6 +467,643 @@ void VaporPlus::CreateRaytracingOutputResource()
 	m_raytracingOutputResourceUAVGpuDescriptor = CD3DX12_GPU_DESCRIPTOR_HANDLE(m_raytracingDescriptorHeap.GetGPUDescriptorHandleForHeapStart(), m_raytracingOutputResourceUAVDescriptorHeapIndexDuringRaytracing, m_descriptorSize);
 
 	m_postprocess.CreateRaytracedInputUAV(m_raytracingOutput.Get());
+
+	// A new output texture has no previous frame in it.
+	m_checkerboardHistoryValid = false;
+}
+
+// Convert a distance along a Hilbert curve filling a curveSize x curveSize grid into grid coordinates.
+static void HilbertIndexToTile(UINT curveSize, UINT index, UINT* x, UINT* y)
+{
+	*x = 0;
+	*y = 0;
+	for (UINT s = 1; s < curveSize; s *= 2)
+	{
+		UINT rx = 1 & (index / 2);
+		UINT ry = 1 & (index ^ rx);
+		if (ry == 0)
+		{
+			if (rx == 1)
+			{
+				*x = s - 1 - *x;
+				*y = s - 1 - *y;
+			}
+			std::swap(*x, *y);
+		}
+		*x += s * rx;
+		*y += s * ry;
+		index /= 4;
+	}
+}
+
+// Ray generation is dispatched one tile per row, in the order listed here. Walking the tiles along a Hilbert
+// curve keeps consecutive tiles adjacent on screen, which is friendlier to the caches than row-major order.
+void VaporPlus::BuildTileOrder(TileOrder* tileOrder)
+{
+	auto device = m_deviceResources->GetD3DDevice();
+
+	UINT tileCountX = (m_raytracingWidth + RAYGEN_TILE_SIZE - 1) / RAYGEN_TILE_SIZE;
+	UINT tileCountY = (m_raytracingHeight + RAYGEN_TILE_SIZE - 1) / RAYGEN_TILE_SIZE;
+
+	// The curve covers a power-of-two square; tiles outside the screen are skipped.
+	UINT curveSize = 1;
+	while (curveSize < tileCountX || curveSize < tileCountY)
+	{
+		curveSize *= 2;
+	}
+
+	std::vector<UINT> tiles;
+	tiles.reserve(tileCountX * tileCountY);
+	for (UINT index = 0; index < curveSize * curveSize; ++index)
+	{
+		UINT x, y;
+		HilbertIndexToTile(curveSize, index, &x, &y);
+		if (x < tileCountX && y < tileCountY)
+		{
+			tiles.push_back(x | (y << 16));
+		}
+	}
+
+	tileOrder->TileCount = CheckCastUint(tiles.size());
+	tileOrder->Width = m_raytracingWidth;
+	tileOrder->Height = m_raytracingHeight;
+	AllocateUploadBuffer(device, tiles.data(), tiles.size() * sizeof(tiles[0]), &tileOrder->Buffer, L"TileOrder");
+}
+
+// The postprocess averages 9 taps spread 2 * POSTPROCESS_BLUR_OFFSET of the screen across, then goes grayscale
+// and multiplies in noise. Tracing more pixels than fit across that spread is wasted, so divide the resolution
+// by it, up to a quarter.
+UINT VaporPlus::GetRaytracingResolutionDivisor() const
+{
+	if (!m_enablePostprocess)
+		return 1;
+
+	float blurSpreadInPixels = 2.0f * POSTPROCESS_BLUR_OFFSET * static_cast<float>(max(m_width, m_height));
+	return static_cast<UINT>(min(max(roundf(blurSpreadInPixels), 1.0f), 4.0f));
+}
+
+// Pick the traced resolution for the current postprocess setting and governor scale. The output texture stays
+// window sized. Tile orders are rebuilt per frame in DoRaytracing as each frame index comes around.
+void VaporPlus::UpdateRaytracingResolution()
+{
+	float scale = m_resolutionScale / static_cast<float>(GetRaytracingResolutionDivisor());
+	UINT width = max(static_cast<UINT>(m_width * scale), 1u);
+	UINT height = max(static_cast<UINT>(m_height * scale), 1u);
+
+	if (width == m_raytracingWidth && height == m_raytracingHeight)
+		return;
+
+	m_raytracingWidth = width;
+	m_raytracingHeight = height;
+
+	// Cached hits and last frame's checkerboard pixels are per traced pixel, so they don't carry over.
+	InvalidatePrimaryHitCache();
+	m_checkerboardHistoryValid = false;
+	RestartProgressiveRefinement();
+}
+
+// Scale the traced resolution to hold m_targetFrameTimeMs. The frame time is smoothed so one slow frame doesn't
+// cause a change, the scale only moves when the estimate leaves a dead band around the target, and each change
+// is given time to show up in the estimate before the next one.
+void VaporPlus::UpdateResolutionGovernor()
+{
+	static const float c_smoothing = 0.1f;
+	static const float c_overBudget = 1.05f;
+	static const float c_underBudget = 0.85f;
+	static const UINT c_settleFrames = 30;
+	static const float c_minScale = 0.25f;
+	static const float c_scaleGranularity = 1.0f / 16.0f;
+
+	float frameTimeMs = static_cast<float>(m_timer.GetElapsedSeconds() * 1000.0);
+	if (frameTimeMs <= 0.0f)
+		return;
+
+	m_smoothedFrameTimeMs = (m_smoothedFrameTimeMs == 0.0f) ? frameTimeMs : m_smoothedFrameTimeMs + (frameTimeMs - m_smoothedFrameTimeMs) * c_smoothing;
+
+	if (!m_enableResolutionGovernor || ++m_framesSinceResolutionChange < c_settleFrames)
+		return;
+
+	float load = m_smoothedFrameTimeMs / m_targetFrameTimeMs;
+	if (load < c_overBudget && load > c_underBudget)
+		return;
+
+	// Ray count goes with area, so step each dimension by the square root of the load, a limited amount at a time.
+	float scale = m_resolutionScale * min(max(sqrtf(1.0f / load), 0.8f), 1.1f);
+	scale = roundf(scale / c_scaleGranularity) * c_scaleGranularity;
+	scale = min(max(scale, c_minScale), 1.0f);
+	if (scale == m_resolutionScale)
+		return;
+
+	m_resolutionScale = scale;
+	m_framesSinceResolutionChange = 0;
+	UpdateRaytracingResolution();
+
+	std::wstringstream message;
+	message << L"Resolution governor: scale " << scale << L" (" << m_raytracingWidth << L"x" << m_raytracingHeight
+		<< L"), smoothed frame time " << m_smoothedFrameTimeMs << L" ms, target " << m_targetFrameTimeMs << L" ms\n";
+	OutputDebugStringW(message.str().c_str());
+}
+
+void VaporPlus::CreatePrimaryHitCache()
+{
+	auto device = m_deviceResources->GetD3DDevice();
+
+	UINT64 cacheSize = static_cast<UINT64>(m_width) * m_height * sizeof(PrimaryHitRecord);
+	AllocateUAVBuffer(device, cacheSize, &m_primaryHitCache, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, L"PrimaryHitCache");
+
+	InvalidatePrimaryHitCache();
+}
+
+// Make the next frame trace every pixel and record its hit.
+void VaporPlus::InvalidatePrimaryHitCache()
+{
+	m_primaryHitCacheFilledParities = 0;
+	for (auto& bounds : m_previousRetraceBounds)
+	{
+		bounds = XMFLOAT4(0, 0, 0, 0);
+	}
+}
+
+// 2D bounds are stored as min x, min y, max x, max y.
+static bool IsBoundsEmpty(XMFLOAT4 const& bounds)
+{
+	return bounds.z <= bounds.x || bounds.w <= bounds.y;
+}
+
+static float GetBoundsArea(XMFLOAT4 const& bounds)
+{
+	return IsBoundsEmpty(bounds) ? 0.0f : (bounds.z - bounds.x) * (bounds.w - bounds.y);
+}
+
+static XMFLOAT4 UnionBounds(XMFLOAT4 const& a, XMFLOAT4 const& b)
+{
+	if (IsBoundsEmpty(a))
+		return b;
+
+	if (IsBoundsEmpty(b))
+		return a;
+
+	return XMFLOAT4(min(a.x, b.x), min(a.y, b.y), max(a.z, b.z), max(a.w, b.w));
+}
+
+static XMFLOAT4 IntersectBounds(XMFLOAT4 const& a, XMFLOAT4 const& b)
+{
+	return XMFLOAT4(max(a.x, b.x), max(a.y, b.y), min(a.z, b.z), min(a.w, b.w));
+}
+
+// Conservative pixel bounds of an object's box under the given transform, as min x, min y, max x, max y.
+XMFLOAT4 VaporPlus::GetScreenBounds(GeometryObject const& geometryObject, XMMATRIX const& transform) const
+{
+	XMFLOAT3 boundsMin, boundsMax;
+	geometryObject.GetObjectBounds(&boundsMin, &boundsMax);
+
+	XMMATRIX objectToClip = transform * m_viewProj;
+	float width = static_cast<float>(m_raytracingWidth);
+	float height = static_cast<float>(m_raytracingHeight);
+
+	XMFLOAT4 screenBounds(FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		XMVECTOR position = XMVectorSet(
+			(corner & 1) ? boundsMax.x : boundsMin.x,
+			(corner & 2) ? boundsMax.y : boundsMin.y,
+			(corner & 4) ? boundsMax.z : boundsMin.z,
+			1.0f);
+		XMVECTOR clipPosition = XMVector4Transform(position, objectToClip);
+
+		// A corner at or behind the eye doesn't project to anything useful, so assume the object covers everything.
+		float w = XMVectorGetW(clipPosition);
+		if (w <= FLT_EPSILON)
+			return XMFLOAT4(0, 0, width, height);
+
+		float x = (XMVectorGetX(clipPosition) / w * 0.5f + 0.5f) * width;
+		float y = (0.5f - XMVectorGetY(clipPosition) / w * 0.5f) * height;
+		screenBounds = XMFLOAT4(min(screenBounds.x, x), min(screenBounds.y, y), max(screenBounds.z, x), max(screenBounds.w, y));
+	}
+
+	// Pad by a pixel so rounding never leaves a touched pixel out, then clip to the screen.
+	return XMFLOAT4(
+		max(floorf(screenBounds.x) - 1.0f, 0.0f),
+		max(floorf(screenBounds.y) - 1.0f, 0.0f),
+		min(ceilf(screenBounds.z) + 1.0f, width),
+		min(ceilf(screenBounds.w) + 1.0f, height));
+}
+
+void VaporPlus::CreateFloorShadowCache()
+{
+	auto device = m_deviceResources->GetD3DDevice();
+
+	// World bounds of the floor's top face, which the cache texels span.
+	{
+		XMFLOAT3 boundsMin, boundsMax;
+		m_floor.GetObjectBounds(&boundsMin, &boundsMax);
+
+		XMFLOAT3 worldMin, worldMax;
+		XMStoreFloat3(&worldMin, XMVector3TransformCoord(XMLoadFloat3(&boundsMin), m_floor.GetTransform()));
+		XMStoreFloat3(&worldMax, XMVector3TransformCoord(XMLoadFloat3(&boundsMax), m_floor.GetTransform()));
+
+		m_floorShadowCacheBounds = XMFLOAT4(min(worldMin.x, worldMax.x), min(worldMin.z, worldMax.z), max(worldMin.x, worldMax.x), max(worldMin.z, worldMax.z));
+		m_floorTopY = max(worldMin.y, worldMax.y);
+	}
+
+	auto textureDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32_UINT, FLOOR_SHADOW_CACHE_WIDTH, FLOOR_SHADOW_CACHE_HEIGHT, 1, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+	auto defaultHeapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+	ThrowIfFailed(device->CreateCommittedResource(
+		&defaultHeapProperties, D3D12_HEAP_FLAG_NONE, &textureDesc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(&m_floorShadowCache)));
+	NAME_D3D12_OBJECT(m_floorShadowCache);
+
+	D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+	uavDesc.Format = DXGI_FORMAT_R32_UINT;
+	uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+
+	{
+		D3D12_CPU_DESCRIPTOR_HANDLE uavDescriptorHandle;
+		UINT descriptorIndex = m_raytracingDescriptorHeap.AllocateDescriptor(&uavDescriptorHandle);
+		device->CreateUnorderedAccessView(m_floorShadowCache.Get(), nullptr, &uavDesc, uavDescriptorHandle);
+		m_floorShadowCacheUAVGpuDescriptor = CD3DX12_GPU_DESCRIPTOR_HANDLE(m_raytracingDescriptorHeap.GetGPUDescriptorHandleForHeapStart(), descriptorIndex, m_descriptorSize);
+	}
+
+	{
+		D3D12_DESCRIPTOR_HEAP_DESC descriptorHeapDesc = {};
+		descriptorHeapDesc.NumDescriptors = 1;
+		descriptorHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+		descriptorHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+		ThrowIfFailed(device->CreateDescriptorHeap(&descriptorHeapDesc, IID_PPV_ARGS(&m_floorShadowCacheClearHeap)));
+		NAME_D3D12_OBJECT(m_floorShadowCacheClearHeap);
+
+		device->CreateUnorderedAccessView(m_floorShadowCache.Get(), nullptr, &uavDesc, m_floorShadowCacheClearHeap->GetCPUDescriptorHandleForHeapStart());
+	}
+
+	// The texture starts out undefined, so the first frame clears all of it.
+	m_floorShadowCacheCleared = false;
+	for (auto& bounds : m_previousFloorShadowBounds)
+	{
+		bounds = XMFLOAT4(0, 0, 0, 0);
+	}
+
+	AllocateUAVBuffer(device, SHADOW_RAY_STATS_SIZE, &m_shadowRayStats, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, L"ShadowRayStats");
+
+	auto readbackHeapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK);
+	auto readbackDesc = CD3DX12_RESOURCE_DESC::Buffer(FrameCount * SHADOW_RAY_STATS_SIZE);
+	ThrowIfFailed(device->CreateCommittedResource(
+		&readbackHeapProperties, D3D12_HEAP_FLAG_NONE, &readbackDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&m_shadowRayStatsReadback)));
+	NAME_D3D12_OBJECT(m_shadowRayStatsReadback);
+
+	// Kept mapped for the lifetime of the resource. Each slot is only read after the frame that wrote it has finished.
+	ThrowIfFailed(m_shadowRayStatsReadback->Map(0, nullptr, reinterpret_cast<void**>(&m_mappedShadowRayStats)));
+	std::fill(std::begin(m_shadowRayStatsPending), std::end(m_shadowRayStatsPending), false);
+	m_shadowRayTotals[0] = m_shadowRayTotals[1] = 0;
+}
+
+void VaporPlus::CreateTextureFeedback()
+{
+	auto device = m_deviceResources->GetD3DDevice();
+
+	AllocateUAVBuffer(device, TEXTURE_FEEDBACK_SIZE, &m_textureFeedback, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, L"TextureFeedback");
+
+	// Copied over the feedback before each dispatch, so every texture starts the frame unsampled.
+	UINT notSampled[TEXTURE_FEEDBACK_SIZE / sizeof(UINT)];
+	std::fill(std::begin(notSampled), std::end(notSampled), TEXTURE_FEEDBACK_NOT_SAMPLED);
+	AllocateUploadBuffer(device, notSampled, sizeof(notSampled), &m_textureFeedbackReset, L"TextureFeedbackReset");
+
+	auto readbackHeapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK);
+	auto readbackDesc = CD3DX12_RESOURCE_DESC::Buffer(FrameCount * TEXTURE_FEEDBACK_SIZE);
+	ThrowIfFailed(device->CreateCommittedResource(
+		&readbackHeapProperties, D3D12_HEAP_FLAG_NONE, &readbackDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&m_textureFeedbackReadback)));
+	NAME_D3D12_OBJECT(m_textureFeedbackReadback);
+
+	// Kept mapped like the shadow ray stats. Slots no frame has written yet read as unsampled.
+	ThrowIfFailed(m_textureFeedbackReadback->Map(0, nullptr, reinterpret_cast<void**>(&m_mappedTextureFeedback)));
+	std::fill(m_mappedTextureFeedback, m_mappedTextureFeedback + FrameCount * TEXTURE_FEEDBACK_SIZE / sizeof(UINT), TEXTURE_FEEDBACK_NOT_SAMPLED);
+}
+
+// Picks the mip levels each streamed texture should hold from the feedback of the last frame with this frame index, and
+// re-uploads a texture from system memory when that changes. Within the budget a texture keeps finer levels than it was
+// last sampled at, as a cache. Over it, the least recently sampled texture gives up levels first: those finer than it
+// needs, then those it needs. Each texture's coarsest levels always stay, even if they alone overrun the budget.
+void VaporPlus::UpdateTextureResidency()
+{
+	UINT frameIndex = m_deviceResources->GetCurrentFrameIndex();
+
+	// Without -textureBudget every level stays resident and there are no sources to stream from.
+	m_sceneCB[frameIndex].textureStreamingEnabled = m_textureBudgetBytes != UINT64_MAX;
+	if (!m_sceneCB[frameIndex].textureStreamingEnabled)
+	{
+		m_sceneCB[frameIndex].checkerboardResidentMip = 0;
+		m_sceneCB[frameIndex].cityscapeResidentMip = 0;
+		return;
+	}
+
+	// This frame index's previous frame has finished, so the textures it replaced can go and its feedback can be read.
+	m_textureReleases[frameIndex].clear();
+	UINT const* feedback = m_mappedTextureFeedback + frameIndex * TEXTURE_FEEDBACK_SIZE / sizeof(UINT);
+
+	UINT wantedMips[StreamedTextureCount];
+	for (UINT i = 0; i < StreamedTextureCount; ++i)
+	{
+		StreamedTexture& texture = m_streamedTextures[i];
+		UINT sampledMip = feedback[texture.FeedbackOffset / sizeof(UINT)];
+		if (sampledMip != TEXTURE_FEEDBACK_NOT_SAMPLED)
+		{
+			texture.SampledMip = min(sampledMip, texture.MaxResidentMip);
+			texture.LastSampledFrame = m_timer.GetFrameCount();
+		}
+		wantedMips[i] = min(texture.ResidentMip, texture.SampledMip);
+	}
+
+	auto getResidentBytes = [&]()
+	{
+		UINT64 bytes = 0;
+		for (UINT i = 0; i < StreamedTextureCount; ++i)
+		{
+			bytes += GetImageTextureBytes(m_streamedTextures[i].Source, wantedMips[i]);
+		}
+		return bytes;
+	};
+
+	for (bool evictSampledLevels : { false, true })
+	{
+		while (getResidentBytes() > m_textureBudgetBytes)
+		{
+			UINT victim = UINT_MAX;
+			for (UINT i = 0; i < StreamedTextureCount; ++i)
+			{
+				StreamedTexture const& texture = m_streamedTextures[i];
+				UINT lowestMip = evictSampledLevels ? texture.MaxResidentMip : texture.SampledMip;
+				if (wantedMips[i] < lowestMip && (victim == UINT_MAX || texture.LastSampledFrame < m_streamedTextures[victim].LastSampledFrame))
+				{
+					victim = i;
+				}
+			}
+			if (victim == UINT_MAX)
+				break;
+			++wantedMips[victim];
+		}
+	}
+
+	auto descriptorHeapGpuBase = m_raytracingDescriptorHeap.GetGPUDescriptorHandleForHeapStart();
+	for (UINT i = 0; i < StreamedTextureCount; ++i)
+	{
+		StreamedTexture& texture = m_streamedTextures[i];
+		if (wantedMips[i] != texture.ResidentMip)
+		{
+			// Frames still in flight sample the old texture, so it's released when this frame index comes around.
+			ComPtr<ID3D12Resource> uploadHeap;
+			m_textureReleases[frameIndex].push_back(texture.Resource);
+			texture.Resource = CreateImageTexture(texture.Source, wantedMips[i], &uploadHeap);
+			m_textureReleases[frameIndex].push_back(uploadHeap);
+			texture.ResidentMip = wantedMips[i];
+			++m_textureResidencyChanges;
+
+			TextureInfo& textureInfo = GetTextureInfo(texture.TextureID);
+			textureInfo.Resource = texture.Resource;
+			++textureInfo.Generation;
+		}
+
+		// The other frame indices' SRVs may still be in use, so only this one's is rewritten.
+		TextureInfo& textureInfo = GetTextureInfo(texture.TextureID);
+		if (texture.DescriptorGenerations[frameIndex] != textureInfo.Generation)
+		{
+			D3D12_CPU_DESCRIPTOR_HANDLE srvDescriptorHandle;
+			m_raytracingDescriptorHeap.AllocateDescriptor(&srvDescriptorHandle, texture.DescriptorIndices[frameIndex]);
+			CreateImageTextureSRV(texture.Source, texture.ResidentMip, texture.Resource.Get(), srvDescriptorHandle);
+			texture.DescriptorGenerations[frameIndex] = textureInfo.Generation;
+		}
+		textureInfo.ResourceDescriptor = CD3DX12_GPU_DESCRIPTOR_HANDLE(descriptorHeapGpuBase, texture.DescriptorIndices[frameIndex], m_descriptorSize);
+	}
+
+	m_sceneCB[frameIndex].checkerboardResidentMip = m_streamedTextures[0].ResidentMip;
+	m_sceneCB[frameIndex].cityscapeResidentMip = m_streamedTextures[1].ResidentMip;
+	m_textureResidentBytes = getResidentBytes();
+}
+
+// Conservative xz bounds of the shadow an object's box casts onto the floor's top face, as min x, min z, max x, max z.
+XMFLOAT4 VaporPlus::GetFloorShadowBounds(GeometryObject const& geometryObject, XMMATRIX const& transform) const
+{
+	XMFLOAT3 boundsMin, boundsMax;
+	geometryObject.GetObjectBounds(&boundsMin, &boundsMax);
+
+	XMFLOAT4 lightPosition;
+	XMStoreFloat4(&lightPosition, m_sceneCB[m_deviceResources->GetCurrentFrameIndex()].lightPosition);
+
+	XMFLOAT4 shadowBounds(FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		XMVECTOR position = XMVectorSet(
+			(corner & 1) ? boundsMax.x : boundsMin.x,
+			(corner & 2) ? boundsMax.y : boundsMin.y,
+			(corner & 4) ? boundsMax.z : boundsMin.z,
+			1.0f);
+		XMFLOAT3 worldPosition;
+		XMStoreFloat3(&worldPosition, XMVector3TransformCoord(position, transform));
+
+		// A corner level with or above the light throws its shadow off to infinity.
+		if (worldPosition.y >= lightPosition.y - 0.001f)
+			return m_floorShadowCacheBounds;
+
+		// Follow the ray from the light through the corner down to the floor.
+		float t = (lightPosition.y - m_floorTopY) / (lightPosition.y - worldPosition.y);
+		float x = lightPosition.x + (worldPosition.x - lightPosition.x) * t;
+		float z = lightPosition.z + (worldPosition.z - lightPosition.z) * t;
+		shadowBounds = XMFLOAT4(min(shadowBounds.x, x), min(shadowBounds.y, z), max(shadowBounds.z, x), max(shadowBounds.w, z));
+	}
+
+	return IntersectBounds(shadowBounds, m_floorShadowCacheBounds);
+}
+
+// Clear the floor shadow cache wherever a moving object's shadow could have appeared or disappeared.
+void VaporPlus::UpdateFloorShadowCache(SceneSnapshot const& snapshot)
+{
+	auto frameIndex = m_deviceResources->GetCurrentFrameIndex();
+	SceneConstantBuffer& sceneCB = m_sceneCB[frameIndex];
+
+	sceneCB.floorShadowCacheBounds = m_floorShadowCacheBounds;
+	sceneCB.floorShadowCacheEnabled = m_enableFloorShadowCache ? 1 : 0;
+
+	// Same coverage as the primary hit cache: both transforms the traced geometry can be at, and last frame's area.
+	float texelsPerUnitX = FLOOR_SHADOW_CACHE_WIDTH / (m_floorShadowCacheBounds.z - m_floorShadowCacheBounds.x);
+	float texelsPerUnitZ = FLOOR_SHADOW_CACHE_HEIGHT / (m_floorShadowCacheBounds.w - m_floorShadowCacheBounds.y);
+
+	m_floorShadowCacheClearRects.clear();
+	for (UINT i = 0; i < MovingObjectCount; ++i)
+	{
+		UINT geometryID = m_movingGeometryIDs[i];
+		GeometryObject const& movingObject = *m_geometryObjects[geometryID];
+		XMFLOAT4 bounds = UnionBounds(
+			GetFloorShadowBounds(movingObject, snapshot.TracedTransforms[geometryID]),
+			GetFloorShadowBounds(movingObject, snapshot.LatestTransforms[geometryID]));
+
+		XMFLOAT4 clearBounds = UnionBounds(bounds, m_previousFloorShadowBounds[i]);
+		m_previousFloorShadowBounds[i] = bounds;
+
+		if (IsBoundsEmpty(clearBounds))
+			continue;
+
+		// Pad by a texel so rounding never leaves a touched texel out.
+		float left = floorf((clearBounds.x - m_floorShadowCacheBounds.x) * texelsPerUnitX) - 1.0f;
+		float top = floorf((clearBounds.y - m_floorShadowCacheBounds.y) * texelsPerUnitZ) - 1.0f;
+		float right = ceilf((clearBounds.z - m_floorShadowCacheBounds.x) * texelsPerUnitX) + 1.0f;
+		float bottom = ceilf((clearBounds.w - m_floorShadowCacheBounds.y) * texelsPerUnitZ) + 1.0f;
+
+		D3D12_RECT rect;
+		rect.left = static_cast<LONG>(max(left, 0.0f));
+		rect.top = static_cast<LONG>(max(top, 0.0f));
+		rect.right = static_cast<LONG>(min(right, static_cast<float>(FLOOR_SHADOW_CACHE_WIDTH)));
+		rect.bottom = static_cast<LONG>(min(bottom, static_cast<float>(FLOOR_SHADOW_CACHE_HEIGHT)));
+		if (rect.right > rect.left && rect.bottom > rect.top)
+		{
+			m_floorShadowCacheClearRects.push_back(rect);
+		}
+	}
+
+	// This frame's readback slot was last written FrameCount frames ago, and that frame has finished. Shadow rays are
+	// only counted, and the slot only written, while the cache is on; the running totals don't move in between.
+	if (!m_shadowRayStatsPending[frameIndex])
+	{
+		m_shadowRaysTraced = 0;
+		m_shadowRaysCached = 0;
+		return;
+	}
+	m_shadowRayStatsPending[frameIndex] = false;
+
+	UINT const* totals = m_mappedShadowRayStats + frameIndex * (SHADOW_RAY_STATS_SIZE / sizeof(UINT));
+	UINT traced = totals[SHADOW_RAY_STATS_TRACED_OFFSET / sizeof(UINT)];
+	UINT cached = totals[SHADOW_RAY_STATS_CACHED_OFFSET / sizeof(UINT)];
+	m_shadowRaysTraced = traced - m_shadowRayTotals[0];
+	m_shadowRaysCached = cached - m_shadowRayTotals[1];
+	m_shadowRayTotals[0] = traced;
+	m_shadowRayTotals[1] = cached;
+}
+
+// Alternate which half of the pixels is traced. The other half is filled in by MyCheckerboardResolveShader.
+void VaporPlus::UpdateCheckerboard()
+{
+	auto frameIndex = m_deviceResources->GetCurrentFrameIndex();
+	SceneConstantBuffer& sceneCB = m_sceneCB[frameIndex];
+
+	m_checkerboardParity = 1 - m_checkerboardParity;
+
+	// A progressive pass traces its own subset of pixels, and leaves mostly filled-in pixels behind.
+	bool progressivePass = sceneCB.progressiveStride > 1;
+
+	sceneCB.checkerboardEnabled = (m_enableCheckerboard && !progressivePass) ? 1 : 0;
+	sceneCB.checkerboardParity = m_checkerboardParity;
+	sceneCB.checkerboardHistoryValid = m_checkerboardHistoryValid ? 1 : 0;
+
+	// Without checkerboarding every pixel is traced, so either way the next frame has a full previous frame.
+	m_checkerboardHistoryValid = !progressivePass;
+}
+
+// Start over from the sparsest progressive pass. Called when what's traced no longer matches the output, and on
+// every key press or resize, since those change the scene or how it's drawn.
+void VaporPlus::RestartProgressiveRefinement()
+{
+	if (!m_enableProgressiveRefinement)
+		return;
+
+	m_progressivePass = 0;
+	QueryPerformanceCounter(&m_progressiveStartTime);
+}
+
+void VaporPlus::UpdateProgressiveRefinement()
+{
+	auto frameIndex = m_deviceResources->GetCurrentFrameIndex();
+	SceneConstantBuffer& sceneCB = m_sceneCB[frameIndex];
+
+	// The last pass traces every pixel, the same as a frame without refinement.
+	static_assert((RAYGEN_TILE_SIZE >> (ProgressivePassCount - 1)) == 1, "Progressive passes halve the stride down to 1.");
+	sceneCB.progressiveStride = (m_progressivePass < ProgressivePassCount) ? (RAYGEN_TILE_SIZE >> m_progressivePass) : 1;
+}
+
+// Called once a progressive pass has been presented. The times are from the restart to Present returning.
+void VaporPlus::CompleteProgressivePass()
+{
+	LARGE_INTEGER performanceCounter;
+	QueryPerformanceCounter(&performanceCounter);
+	float elapsedMs = static_cast<float>(performanceCounter.QuadPart - m_progressiveStartTime.QuadPart) * 1000.0f / static_cast<float>(m_performanceFrequency.QuadPart);
+
+	if (m_progressivePass == 0)
+	{
+		m_progressiveFirstImageMs = elapsedMs;
+	}
+	if (m_progressivePass == ProgressivePassCount - 1)
+	{
+		m_progressiveFinalImageMs = elapsedMs;
+	}
+	++m_progressivePass;
+}
+
+// Take the transforms this frame is set up with. The BLAS refit runs before UpdateAnimation moves the objects,
+// so the traced geometry is at GetPreviousTransform(), and the shaders have to agree with it.
+VaporPlus::SceneSnapshot const& VaporPlus::CaptureSceneSnapshot()
+{
+	auto frameIndex = m_deviceResources->GetCurrentFrameIndex();
+	SceneConstantBuffer& sceneCB = m_sceneCB[frameIndex];
+
+	static_assert(GeometryCount * sizeof(XMMATRIX) == sizeof(SceneConstantBuffer::perGeometryTransform), "One transform per geometry.");
+	for (UINT i = 0; i < GeometryCount; ++i)
+	{
+		m_sceneSnapshot.TracedTransforms[i] = m_geometryObjects[i]->GetPreviousTransform();
+		m_sceneSnapshot.LatestTransforms[i] = m_geometryObjects[i]->GetTransform();
+		sceneCB.perGeometryTransform[i] = m_sceneSnapshot.TracedTransforms[i];
+	}
+	return m_sceneSnapshot;
+}
+
+// Choose which pixels trace their primary ray this frame. Everything else reshades its cached primary hit.
+void VaporPlus::UpdatePrimaryHitCache(SceneSnapshot const& snapshot)
+{
+	auto frameIndex = m_deviceResources->GetCurrentFrameIndex();
+	SceneConstantBuffer& sceneCB = m_sceneCB[frameIndex];
+
+	// Each rect covers the traced and latest transform, plus last frame's rect so that pixels an object has just
+	// moved off are traced again too.
+	static_assert(MovingObjectCount == PRIMARY_HIT_CACHE_RETRACE_RECT_COUNT, "One retrace rect per moving object.");
+
+	for (UINT i = 0; i < MovingObjectCount; ++i)
+	{
+		UINT geometryID = m_movingGeometryIDs[i];
+		GeometryObject const& movingObject = *m_geometryObjects[geometryID];
+		XMFLOAT4 bounds = UnionBounds(
+			GetScreenBounds(movingObject, snapshot.TracedTransforms[geometryID]),
+			GetScreenBounds(movingObject, snapshot.LatestTransforms[geometryID]));
+
+		sceneCB.primaryHitCacheRetraceRects[i] = UnionBounds(bounds, m_previousRetraceBounds[i]);
+		m_previousRetraceBounds[i] = bounds;
+	}
+
+	// Nothing reads the records unless the cache or the checkerboard resolve is on, so they aren't written otherwise,
+	// and the cache has to fill again once they are.
+	sceneCB.primaryHitRecordsEnabled = (m_enablePrimaryHitCache || sceneCB.checkerboardEnabled) ? 1 : 0;
+	if (!sceneCB.primaryHitRecordsEnabled)
+	{
+		m_primaryHitCacheFilledParities = 0;
+	}
+
+	sceneCB.primaryHitCacheValid = (m_enablePrimaryHitCache && m_primaryHitCacheFilledParities == 3) ? 1 : 0;
+
+	// Every pixel not served from the cache records its hit, so after this frame the pixels it covered are filled.
+	// A checkerboard frame only covers one parity, and a progressive pass too few pixels to count.
+	if (sceneCB.primaryHitRecordsEnabled && sceneCB.progressiveStride <= 1)
+	{
+		m_primaryHitCacheFilledParities |= sceneCB.checkerboardEnabled ? (1u << sceneCB.checkerboardParity) : 3u;
+	}
+
+	if (sceneCB.primaryHitCacheValid)
+	{
+		XMFLOAT4 const* rects = sceneCB.primaryHitCacheRetraceRects;
+		float retracedArea =
+			GetBoundsArea(rects[0]) + GetBoundsArea(rects[1]) + GetBoundsArea(rects[2])
+			- GetBoundsArea(IntersectBounds(rects[0], rects[1]))
+			- GetBoundsArea(IntersectBounds(rects[0], rects[2]))
+			- GetBoundsArea(IntersectBounds(rects[1], rects[2]))
+			+ GetBoundsArea(IntersectBounds(IntersectBounds(rects[0], rects[1]), rects[2]));
+		m_retracedPixelFraction = retracedArea / static_cast<float>(m_raytracingWidth * m_raytracingHeight);
+	}
+	else
+	{
+		m_retracedPixelFraction = 1.0f;
+	}
 }
 
 void VaporPlus::CreateSampler()
@@ -399,6 +1125,14 @@ void VaporPlus::CreateSampler()
 	device->CreateSampler(&sampler, samplerDescriptorHandle);
 	m_samplerDescriptor = CD3DX12_GPU_DESCRIPTOR_HANDLE(m_samplerDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
 
+	// Second sampler, used by the postprocess to upscale the raytracing output when it's traced at reduced resolution.
+	sampler.Filter = D3D12_FILTER_MIN_MAG_MIP_LINEAR;
+	sampler.AddressU = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+	sampler.AddressV = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+	sampler.AddressW = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+	UINT samplerDescriptorSize = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER);
+	device->CreateSampler(&sampler, CD3DX12_CPU_DESCRIPTOR_HANDLE(samplerDescriptorHandle, 1, samplerDescriptorSize));
+
 }
 
 void VaporPlus::CreateDescriptorHeaps()
@@ -409,14 +1143,15 @@ void VaporPlus::CreateDescriptorHeaps()
 	// 2 - vertex and index buffer SRVs
 	// 1 - raytracing output texture SRV
 	// 2 - bottom and top level acceleration structure fallback wrapped pointer UAVs
-	// Then five more for textures
-	m_raytracingDescriptorHeap.Initialize(device, 10);
+	// 1 - floor shadow cache UAV
+	// Then five more for textures, with a table of the material textures per frame index
+	m_raytracingDescriptorHeap.Initialize(device, 10 + MaterialTextureCount * (FrameCount - 1));
 
 	m_descriptorSize = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
 	   
 	{
 		D3D12_DESCRIPTOR_HEAP_DESC descriptorHeapDesc = {};
-		descriptorHeapDesc.NumDescriptors = 1;
+		descriptorHeapDesc.NumDescriptors = 2;
 		descriptorHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER;
 		descriptorHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
 		descriptorHeapDesc.NodeMask = 0;
@@ -493,6 +1228,34 @@ void VaporPlus::BuildGeometry()
 
 	m_totalVertexCount = allVertices.size();
 
+	// Acceleration structure builds and refits only need positions. Keep them in their own tightly packed,
+	// GPU-local stream so the per-frame refit doesn't pull the shading attributes across the bus.
+	{
+		std::vector<XMFLOAT3> positions;
+		positions.reserve(allVertices.size());
+		for (Vertex const& vertex : allVertices)
+		{
+			positions.push_back(vertex.position);
+		}
+
+		size_t positionBufferSize = positions.size() * sizeof(positions[0]);
+
+		auto defaultHeapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+		auto positionBufferDesc = CD3DX12_RESOURCE_DESC::Buffer(positionBufferSize);
+		ThrowIfFailed(device->CreateCommittedResource(
+			&defaultHeapProperties, D3D12_HEAP_FLAG_NONE, &positionBufferDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&m_positionBuffer.resource)));
+		NAME_D3D12_OBJECT(m_positionBuffer.resource);
+
+		ComPtr<ID3D12Resource> positionUploadHeap;
+		AllocateUploadBuffer(device, positions.data(), positionBufferSize, &positionUploadHeap, L"PositionUploadHeap");
+
+		m_deviceResources->PrepareOffscreen();
+		m_deviceResources->GetCommandList()->CopyBufferRegion(m_positionBuffer.resource.Get(), 0, positionUploadHeap.Get(), 0, positionBufferSize);
+		m_deviceResources->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_positionBuffer.resource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
+		m_deviceResources->ExecuteCommandList();
+		m_deviceResources->WaitForGpu();
+	}
+
     // Vertex buffer is passed to the shader along with index buffer as a descriptor table.
     // Vertex buffer descriptor must follow index buffer descriptor in the descriptor heap.
 	UINT descriptorIndexIB = m_raytracingDescriptorHeap.CreateBufferSRV(&m_indexBuffer, CheckCastUint(indexBufferSize) / 4, 0);
@@ -507,10 +1270,10 @@ void VaporPlus::UpdateBottomLevelAccelerationStructure()
 	auto commandAllocator = m_deviceResources->GetCommandAllocator();
 
 	std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geometryDescs;
-	geometryDescs.push_back(m_floor.GetRaytracingGeometryDesc(&m_vertexBuffer, &m_indexBuffer, m_totalVertexCount));
-	geometryDescs.push_back(m_helios.GetRaytracingGeometryDesc(&m_vertexBuffer, &m_indexBuffer, m_totalVertexCount));
-	geometryDescs.push_back(m_cityscape.GetRaytracingGeometryDesc(&m_vertexBuffer, &m_indexBuffer, m_totalVertexCount));
-	geometryDescs.push_back(m_text.GetRaytracingGeometryDesc(&m_vertexBuffer, &m_indexBuffer, m_totalVertexCount));
+	geometryDescs.push_back(m_floor.GetRaytracingGeometryDesc(&m_positionBuffer, &m_indexBuffer, m_totalVertexCount));
+	geometryDescs.push_back(m_helios.GetRaytracingGeometryDesc(&m_positionBuffer, &m_indexBuffer, m_totalVertexCount));
+	geometryDescs.push_back(m_cityscape.GetRaytracingGeometryDesc(&m_positionBuffer, &m_indexBuffer, m_totalVertexCount));
+	geometryDescs.push_back(m_text.GetRaytracingGeometryDesc(&m_positionBuffer, &m_indexBuffer, m_totalVertexCount));
 
 	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC bottomLevelBuildDesc = {};
 	bottomLevelBuildDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
@@ -553,10 +1316,10 @@ void VaporPlus::BuildAccelerationStructures()
     commandList->Reset(commandAllocator, nullptr);
 
 	std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geometryDescs;
-	geometryDescs.push_back(m_floor.GetRaytracingGeometryDesc(&m_vertexBuffer, &m_indexBuffer, m_totalVertexCount));
-	geometryDescs.push_back(m_helios.GetRaytracingGeometryDesc(&m_vertexBuffer, &m_indexBuffer, m_totalVertexCount));
-	geometryDescs.push_back(m_cityscape.GetRaytracingGeometryDesc(&m_vertexBuffer, &m_indexBuffer, m_totalVertexCount));
-	geometryDescs.push_back(m_text.GetRaytracingGeometryDesc(&m_vertexBuffer, &m_indexBuffer, m_totalVertexCount));
+	geometryDescs.push_back(m_floor.GetRaytracingGeometryDesc(&m_positionBuffer, &m_indexBuffer, m_totalVertexCount));
+	geometryDescs.push_back(m_helios.GetRaytracingGeometryDesc(&m_positionBuffer, &m_indexBuffer, m_totalVertexCount));
+	geometryDescs.push_back(m_cityscape.GetRaytracingGeometryDesc(&m_positionBuffer, &m_indexBuffer, m_totalVertexCount));
+	geometryDescs.push_back(m_text.GetRaytracingGeometryDesc(&m_positionBuffer, &m_indexBuffer, m_totalVertexCount));
 
     // Get required sizes for an acceleration structure.
     D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
@@ -642,9 +1405,11 @@ void VaporPlus::BuildShaderTables()
     auto device = m_deviceResources->GetD3DDevice();
 
     void* rayGenShaderIdentifier;
+    void* checkerboardResolveShaderIdentifier;
+    void* progressiveFillShaderIdentifier;
     void* missShaderIdentifier;
 	void* missShaderIdentifier_Shadow;
-    void* hitGroupShaderIdentifier;
+	void* hitGroupShaderIdentifiers[MATERIAL_COUNT];
 
     // Get shader identifiers.
     UINT shaderIdentifierSize;
@@ -652,9 +1417,14 @@ void VaporPlus::BuildShaderTables()
 	ThrowIfFailed(m_dxrStateObject.As(&stateObjectProperties));
 
 	rayGenShaderIdentifier = stateObjectProperties->GetShaderIdentifier(c_raygenShaderName);
+	checkerboardResolveShaderIdentifier = stateObjectProperties->GetShaderIdentifier(c_checkerboardResolveShaderName);
+	progressiveFillShaderIdentifier = stateObjectProperties->GetShaderIdentifier(c_progressiveFillShaderName);
 	missShaderIdentifier = stateObjectProperties->GetShaderIdentifier(c_missShaderName);
 	missShaderIdentifier_Shadow = stateObjectProperties->GetShaderIdentifier(c_missShaderName_Shadow);
-	hitGroupShaderIdentifier = stateObjectProperties->GetShaderIdentifier(c_hitGroupName);
+	for (int i = 0; i < MATERIAL_COUNT; ++i)
+	{
+		hitGroupShaderIdentifiers[i] = stateObjectProperties->GetShaderIdentifier(c_hitGroupNames[i]);
+	}
 	
 	shaderIdentifierSize = D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES;
 
@@ -665,6 +1435,14 @@ void VaporPlus::BuildShaderTables()
         ShaderTable rayGenShaderTable(device, numShaderRecords, shaderRecordSize, L"RayGenShaderTable");
         rayGenShaderTable.push_back(ShaderRecord(rayGenShaderIdentifier, shaderIdentifierSize));
         m_rayGenShaderTable = rayGenShaderTable.GetResource();
+
+        ShaderTable checkerboardResolveShaderTable(device, numShaderRecords, shaderRecordSize, L"CheckerboardResolveShaderTable");
+        checkerboardResolveShaderTable.push_back(ShaderRecord(checkerboardResolveShaderIdentifier, shaderIdentifierSize));
+        m_checkerboardResolveShaderTable = checkerboardResolveShaderTable.GetResource();
+
+        ShaderTable progressiveFillShaderTable(device, numShaderRecords, shaderRecordSize, L"ProgressiveFillShaderTable");
+        progressiveFillShaderTable.push_back(ShaderRecord(progressiveFillShaderIdentifier, shaderIdentifierSize));
+        m_progressiveFillShaderTable = progressiveFillShaderTable.GetResource();
     }
 
     // Miss shader table
@@ -688,47 +1466,41 @@ void VaporPlus::BuildShaderTables()
 		uint32_t m_recordSize = shaderIdentifierSize + sizeof(HitGroupArgument);
 		ShaderTable hitGroupShaderTable(device, m_hitGroupShaderRecordCount, m_recordSize, L"HitGroupShaderTable");
 
+		// Records are in BLAS geometry order. Each geometry gets the hit group specialized for its material,
+		// for both the primary ray and the shadow ray slot.
+		GeometryObject* geometryObjects[] = { &m_floor, &m_helios, &m_cityscape, &m_text };
+		std::vector<PerGeometryConstantBuffer> perGeometryConstants;
+		for (uint32_t geometryID = 0; geometryID < ARRAYSIZE(geometryObjects); ++geometryID)
 		{
+			GeometryObject* geometryObject = geometryObjects[geometryID];
+
 			HitGroupArgument argument;
 			argument.cb = m_perGeometryConstantBuffer;
-			argument.cb.material = m_floor.GetMaterial();
-			argument.cb.indexBufferOffset = m_floor.GetIndexBufferOffset();
-			argument.cb.geometryID = 0;
-			hitGroupShaderTable.push_back(ShaderRecord(hitGroupShaderIdentifier, shaderIdentifierSize, &argument, sizeof(argument)));
-			hitGroupShaderTable.push_back(ShaderRecord(hitGroupShaderIdentifier, shaderIdentifierSize, &argument, sizeof(argument)));
-		}
-		{
-			HitGroupArgument argument;
-			argument.cb = m_perGeometryConstantBuffer;
-			argument.cb.material = m_helios.GetMaterial();
-			argument.cb.indexBufferOffset = m_helios.GetIndexBufferOffset();
-			argument.cb.geometryID = 1;
-			hitGroupShaderTable.push_back(ShaderRecord(hitGroupShaderIdentifier, shaderIdentifierSize, &argument, sizeof(argument)));
-			hitGroupShaderTable.push_back(ShaderRecord(hitGroupShaderIdentifier, shaderIdentifierSize, &argument, sizeof(argument)));
-		}
-		{
-			HitGroupArgument argument;
-			argument.cb = m_perGeometryConstantBuffer;
-			argument.cb.material = m_cityscape.GetMaterial();
-			argument.cb.indexBufferOffset = m_cityscape.GetIndexBufferOffset();
-			argument.cb.geometryID = 2;
-			hitGroupShaderTable.push_back(ShaderRecord(hitGroupShaderIdentifier, shaderIdentifierSize, &argument, sizeof(argument)));
-			hitGroupShaderTable.push_back(ShaderRecord(hitGroupShaderIdentifier, shaderIdentifierSize, &argument, sizeof(argument)));
-		}
-		{
-			HitGroupArgument argument;
-			argument.cb = m_perGeometryConstantBuffer;
-			argument.cb.material = m_text.GetMaterial();
-			argument.cb.indexBufferOffset = m_text.GetIndexBufferOffset();
-			argument.cb.geometryID = 3;
+			argument.cb.material = geometryObject->GetMaterial();
+			argument.cb.indexBufferOffset = geometryObject->GetIndexBufferOffset();
+			argument.cb.geometryID = geometryID;
+
+			void* hitGroupShaderIdentifier = hitGroupShaderIdentifiers[argument.cb.material - CHECKERBOARD_FLOOR_MATERIAL];
 			hitGroupShaderTable.push_back(ShaderRecord(hitGroupShaderIdentifier, shaderIdentifierSize, &argument, sizeof(argument)));
 			hitGroupShaderTable.push_back(ShaderRecord(hitGroupShaderIdentifier, shaderIdentifierSize, &argument, sizeof(argument)));
+
+			perGeometryConstants.push_back(argument.cb);
 		}
 
         m_hitGroupShaderTable = hitGroupShaderTable.GetResource();
+
+		// Cached primary hits are shaded in the ray generation shader, which has no hit group record to
+		// read these from, so they're also available indexed by geometry ID.
+		AllocateUploadBuffer(
+			device,
+			perGeometryConstants.data(),
+			perGeometryConstants.size() * sizeof(perGeometryConstants[0]),
+			&m_perGeometryConstantsBuffer,
+			L"PerGeometryConstants");
     }
 }
 
+// Keys that change what is drawn restart progressive refinement and the input latency timing. Others are ignored.
 void VaporPlus::OnKeyDown(UINT8 key)
 {
 	switch (key)
@@ -739,25 +1511,65 @@ void VaporPlus::OnKeyDown(UINT8 key)
 		m_text.SetSpinEnabled(!m_text.IsSpinEnabled());
 	case 'W':
 		m_enableTextFrame = !m_enableTextFrame;
+		RestartProgressiveRefinement();
 		break;
 	case 'P':
 		m_enablePostprocess = !m_enablePostprocess;
+		UpdateRaytracingResolution();
+		RestartProgressiveRefinement();
 		break;
-	break;
-	default:
+	case 'B':
+		m_enableCheckerboard = !m_enableCheckerboard;
+		m_checkerboardHistoryValid = false;
+		RestartProgressiveRefinement();
 		break;
+	case 'R':
+		m_enableProgressiveRefinement = !m_enableProgressiveRefinement;
+		m_progressivePass = ProgressivePassCount;
+		RestartProgressiveRefinement();
+		break;
+	case 'G':
+	{
+		UINT previousWidth = m_raytracingWidth;
+		UINT previousHeight = m_raytracingHeight;
+		m_enableResolutionGovernor = !m_enableResolutionGovernor;
+		m_resolutionScale = 1.0f;
+		m_framesSinceResolutionChange = 0;
+		UpdateRaytracingResolution();
+
+		// Nothing on screen changes unless the governor had moved the resolution away from full scale.
+		if (m_raytracingWidth == previousWidth && m_raytracingHeight == previousHeight)
+			return;
+		break;
+	}
+	case 'C':
+		m_enablePrimaryHitCache = !m_enablePrimaryHitCache;
+		RestartProgressiveRefinement();
+		break;
+	case 'S':
+		m_enableFloorShadowCache = !m_enableFloorShadowCache;
+		RestartProgressiveRefinement();
+		break;
+	default:
+		return;
 	}
+
+	OnInputChanged();
 }
 
 // Update frame-based values.
 void VaporPlus::OnUpdate()
 {
+	QueryPerformanceCounter(&m_frameTimings[m_deviceResources->GetCurrentFrameIndex()].StartTime);
+
     m_timer.Tick();
     CalculateFrameStats();
     float elapsedTime = static_cast<float>(m_timer.GetElapsedSeconds());
     auto frameIndex = m_deviceResources->GetCurrentFrameIndex();
     auto prevFrameIndex = m_deviceResources->GetPreviousFrameIndex();
 
+    UpdateResolutionGovernor();
+
     // Rotate the camera around Y axis.
     {
         UpdateCameraMatrices();
@@ -769,6 +1581,58 @@ void VaporPlus::OnUpdate()
 void VaporPlus::ParseCommandLineArgs(WCHAR* argv[], int argc)
 {
     DXSample::ParseCommandLineArgs(argv, argc);
+
+    for (int i = 1; i < argc; ++i)
+    {
+        // -targetFrameTime [milliseconds] turns on the resolution governor
+        if (_wcsnicmp(argv[i], L"-targetFrameTime", wcslen(argv[i])) == 0 ||
+            _wcsnicmp(argv[i], L"/targetFrameTime", wcslen(argv[i])) == 0)
+        {
+            ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+            m_targetFrameTimeMs = static_cast<float>(_wtof(argv[i + 1]));
+            ThrowIfFalse(m_targetFrameTimeMs > 0.0f, L"Incorrect argument format passed in.");
+            m_enableResolutionGovernor = true;
+            i++;
+        }
+        // -maxFrameLatency [frames] limits how many frames are queued ahead of the display. 0 keeps the DXGI default.
+        else if (_wcsnicmp(argv[i], L"-maxFrameLatency", wcslen(argv[i])) == 0 ||
+            _wcsnicmp(argv[i], L"/maxFrameLatency", wcslen(argv[i])) == 0)
+        {
+            ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+            m_maxFrameLatency = static_cast<UINT>(_wtoi(argv[i + 1]));
+            ThrowIfFalse(m_maxFrameLatency <= 16, L"Incorrect argument format passed in.");
+            i++;
+        }
+        // -compressTextures stores the raytraced textures as BC1
+        else if (_wcsnicmp(argv[i], L"-compressTextures", wcslen(argv[i])) == 0 ||
+            _wcsnicmp(argv[i], L"/compressTextures", wcslen(argv[i])) == 0)
+        {
+            m_compressTextures = true;
+        }
+        // -textureBudget [KB] limits the GPU memory the raytraced textures' mip levels can take
+        else if (_wcsnicmp(argv[i], L"-textureBudget", wcslen(argv[i])) == 0 ||
+            _wcsnicmp(argv[i], L"/textureBudget", wcslen(argv[i])) == 0)
+        {
+            ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+            int budgetKB = _wtoi(argv[i + 1]);
+            ThrowIfFalse(budgetKB > 0, L"Incorrect argument format passed in.");
+            m_textureBudgetBytes = static_cast<UINT64>(budgetKB) * 1024;
+            i++;
+        }
+        // -framesInFlight [1 to 3] limits how far the CPU can run ahead of the GPU
+        else if (_wcsnicmp(argv[i], L"-framesInFlight", wcslen(argv[i])) == 0 ||
+            _wcsnicmp(argv[i], L"/framesInFlight", wcslen(argv[i])) == 0)
+        {
+            ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+            m_framesInFlight = static_cast<UINT>(_wtoi(argv[i + 1]));
+            ThrowIfFalse(m_framesInFlight >= 1 && m_framesInFlight <= FrameCount, L"Incorrect argument format passed in.");
+            i++;
+        }
+    }
 }
 
 void VaporPlus::DoRaytracing()
@@ -791,10 +1655,49 @@ void VaporPlus::DoRaytracing()
 	// Set index and successive vertex buffer decriptor tables
 	commandList->SetComputeRootDescriptorTable(GlobalRootSignatureParams::VertexBuffersSlot, m_indexBuffer.gpuDescriptorHandle);
 	commandList->SetComputeRootDescriptorTable(GlobalRootSignatureParams::OutputViewSlot, m_raytracingOutputResourceUAVGpuDescriptor);
-	commandList->SetComputeRootDescriptorTable(GlobalRootSignatureParams::CheckerboardTextureSlot, GetTextureInfo(TextureID_Checkerboard).ResourceDescriptor);
+	commandList->SetComputeRootDescriptorTable(GlobalRootSignatureParams::MaterialTexturesSlot,
+		CD3DX12_GPU_DESCRIPTOR_HANDLE(m_raytracingDescriptorHeap.GetGPUDescriptorHandleForHeapStart(), m_materialTextureTableIndices[frameIndex], m_descriptorSize));
 	commandList->SetComputeRootDescriptorTable(GlobalRootSignatureParams::SamplerSlot, m_samplerDescriptor);
-	commandList->SetComputeRootDescriptorTable(GlobalRootSignatureParams::CityscapeTextureSlot, GetTextureInfo(TextureID_Cityscape).ResourceDescriptor);
-	commandList->SetComputeRootDescriptorTable(GlobalRootSignatureParams::TextTextureSlot, GetTextureInfo(TextureID_Text).ResourceDescriptor);
+	TileOrder& tileOrder = m_tileOrders[frameIndex];
+	if (!tileOrder.Buffer || tileOrder.Width != m_raytracingWidth || tileOrder.Height != m_raytracingHeight)
+	{
+		// This frame index's previous frame has finished, so its tile order can be replaced.
+		BuildTileOrder(&tileOrder);
+	}
+	commandList->SetComputeRootShaderResourceView(GlobalRootSignatureParams::TileOrderSlot, tileOrder.Buffer->GetGPUVirtualAddress());
+	commandList->SetComputeRootShaderResourceView(GlobalRootSignatureParams::PerGeometryConstantsSlot, m_perGeometryConstantsBuffer->GetGPUVirtualAddress());
+	commandList->SetComputeRootUnorderedAccessView(GlobalRootSignatureParams::PrimaryHitCacheSlot, m_primaryHitCache->GetGPUVirtualAddress());
+	commandList->SetComputeRootDescriptorTable(GlobalRootSignatureParams::FloorShadowCacheSlot, m_floorShadowCacheUAVGpuDescriptor);
+	commandList->SetComputeRootUnorderedAccessView(GlobalRootSignatureParams::ShadowRayStatsSlot, m_shadowRayStats->GetGPUVirtualAddress());
+	commandList->SetComputeRootUnorderedAccessView(GlobalRootSignatureParams::TextureFeedbackSlot, m_textureFeedback->GetGPUVirtualAddress());
+
+	// Every streamed texture starts the frame unsampled. Without a budget the shaders record no feedback.
+	bool textureStreamingEnabled = m_textureBudgetBytes != UINT64_MAX;
+	if (textureStreamingEnabled)
+	{
+		commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_textureFeedback.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST));
+		commandList->CopyBufferRegion(m_textureFeedback.Get(), 0, m_textureFeedbackReset.Get(), 0, TEXTURE_FEEDBACK_SIZE);
+		commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_textureFeedback.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+	}
+
+	// Invalidate floor shadow texels chosen by UpdateFloorShadowCache. The clear needs the descriptor heap set above.
+	{
+		const UINT unknown[4] = { FLOOR_SHADOW_CACHE_UNKNOWN, FLOOR_SHADOW_CACHE_UNKNOWN, FLOOR_SHADOW_CACHE_UNKNOWN, FLOOR_SHADOW_CACHE_UNKNOWN };
+		D3D12_CPU_DESCRIPTOR_HANDLE clearCpuDescriptor = m_floorShadowCacheClearHeap->GetCPUDescriptorHandleForHeapStart();
+
+		if (!m_floorShadowCacheCleared)
+		{
+			commandList->ClearUnorderedAccessViewUint(m_floorShadowCacheUAVGpuDescriptor, clearCpuDescriptor, m_floorShadowCache.Get(), unknown, 0, nullptr);
+			m_floorShadowCacheCleared = true;
+		}
+		else if (!m_floorShadowCacheClearRects.empty())
+		{
+			commandList->ClearUnorderedAccessViewUint(
+				m_floorShadowCacheUAVGpuDescriptor, clearCpuDescriptor, m_floorShadowCache.Get(), unknown,
+				CheckCastUint(m_floorShadowCacheClearRects.size()), m_floorShadowCacheClearRects.data());
+		}
+		commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(m_floorShadowCache.Get()));
+	}
 
 	commandList->SetComputeRootShaderResourceView(GlobalRootSignatureParams::AccelerationStructureSlot, m_topLevelAccelerationStructure->GetGPUVirtualAddress());
 
@@ -807,11 +1710,61 @@ void VaporPlus::DoRaytracing()
 	dispatchDesc.MissShaderTable.StrideInBytes = dispatchDesc.MissShaderTable.SizeInBytes / m_missShaderRecordCount;
 	dispatchDesc.RayGenerationShaderRecord.StartAddress = m_rayGenShaderTable->GetGPUVirtualAddress();
 	dispatchDesc.RayGenerationShaderRecord.SizeInBytes = m_rayGenShaderTable->GetDesc().Width;
-	dispatchDesc.Width = m_width;
-	dispatchDesc.Height = m_height;
+	SceneConstantBuffer const& sceneCB = m_sceneCB[frameIndex];
+	UINT pixelsPerTile = RAYGEN_TILE_SIZE * RAYGEN_TILE_SIZE;
+	if (sceneCB.progressiveStride > 1)
+	{
+		pixelsPerTile /= sceneCB.progressiveStride * sceneCB.progressiveStride;
+	}
+	else if (sceneCB.checkerboardEnabled)
+	{
+		pixelsPerTile /= 2;
+	}
+	dispatchDesc.Width = pixelsPerTile;
+	dispatchDesc.Height = tileOrder.TileCount;
 	dispatchDesc.Depth = 1;
 	m_dxrCommandList->SetPipelineState1(m_dxrStateObject.Get());
 	m_dxrCommandList->DispatchRays(&dispatchDesc);
+
+	if (sceneCB.progressiveStride > 1)
+	{
+		// The fill reads pixels traced by the dispatch above.
+		commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(m_raytracingOutput.Get()));
+
+		dispatchDesc.RayGenerationShaderRecord.StartAddress = m_progressiveFillShaderTable->GetGPUVirtualAddress();
+		dispatchDesc.RayGenerationShaderRecord.SizeInBytes = m_progressiveFillShaderTable->GetDesc().Width;
+		dispatchDesc.Width = m_raytracingWidth;
+		dispatchDesc.Height = m_raytracingHeight;
+		m_dxrCommandList->DispatchRays(&dispatchDesc);
+	}
+	else if (sceneCB.checkerboardEnabled)
+	{
+		// The resolve reads pixels traced by the dispatch above.
+		commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(m_raytracingOutput.Get()));
+
+		dispatchDesc.RayGenerationShaderRecord.StartAddress = m_checkerboardResolveShaderTable->GetGPUVirtualAddress();
+		dispatchDesc.RayGenerationShaderRecord.SizeInBytes = m_checkerboardResolveShaderTable->GetDesc().Width;
+		dispatchDesc.Width = (m_raytracingWidth + 1) / 2;
+		dispatchDesc.Height = m_raytracingHeight;
+		m_dxrCommandList->DispatchRays(&dispatchDesc);
+	}
+
+	// Copy out the running shadow ray totals. UpdateFloorShadowCache reads them when this frame index comes around again.
+	if (sceneCB.floorShadowCacheEnabled)
+	{
+		commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_shadowRayStats.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE));
+		commandList->CopyBufferRegion(m_shadowRayStatsReadback.Get(), frameIndex * SHADOW_RAY_STATS_SIZE, m_shadowRayStats.Get(), 0, SHADOW_RAY_STATS_SIZE);
+		commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_shadowRayStats.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+		m_shadowRayStatsPending[frameIndex] = true;
+	}
+
+	// Likewise the texture feedback, which UpdateTextureResidency reads.
+	if (textureStreamingEnabled)
+	{
+		commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_textureFeedback.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE));
+		commandList->CopyBufferRegion(m_textureFeedbackReadback.Get(), frameIndex * TEXTURE_FEEDBACK_SIZE, m_textureFeedback.Get(), 0, TEXTURE_FEEDBACK_SIZE);
+		commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_textureFeedback.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+	}
 }
 
 // Update the application state with the new resolution.
@@ -841,7 +1794,13 @@ void VaporPlus::DrawRaytracingOutputToTarget()
 
 	float timer = static_cast<float>(m_timer.GetTotalSeconds());
 	UINT time = *(reinterpret_cast<UINT*>(&timer));
-	UINT constants[2] = { m_enablePostprocess ? 1u : 0u, time };
+	float raytracedUVScaleX = static_cast<float>(m_raytracingWidth) / static_cast<float>(m_width);
+	float raytracedUVScaleY = static_cast<float>(m_raytracingHeight) / static_cast<float>(m_height);
+	UINT constants[4] = {
+		m_enablePostprocess ? 1u : 0u,
+		time,
+		*(reinterpret_cast<UINT*>(&raytracedUVScaleX)),
+		*(reinterpret_cast<UINT*>(&raytracedUVScaleY)) };
 	commandList->SetGraphicsRoot32BitConstants(1, _countof(constants), &constants, 0);
 
 	auto viewport = m_deviceResources->GetScreenViewport();
@@ -875,6 +1834,9 @@ void VaporPlus::DrawRaytracingOutputToTarget()
 void VaporPlus::CreateWindowSizeDependentResources()
 {
     CreateRaytracingOutputResource(); 
+	CreatePrimaryHitCache();
+	UpdateRaytracingResolution();
+	RestartProgressiveRefinement();
     UpdateCameraMatrices();
 }
 
@@ -882,6 +1844,11 @@ void VaporPlus::CreateWindowSizeDependentResources()
 void VaporPlus::ReleaseWindowSizeDependentResources()
 {
     m_raytracingOutput.Reset();
+	for (auto& tileOrder : m_tileOrders)
+	{
+		tileOrder.Buffer.Reset();
+	}
+	m_primaryHitCache.Reset();
 }
 
 // Release all resources that depend on the device.
@@ -897,10 +1864,31 @@ void VaporPlus::ReleaseDeviceDependentResources()
 	m_raytracingOutputResourceUAVDescriptorHeapIndexDuringRaytracing = UINT_MAX;
     m_indexBuffer.resource.Reset();
     m_vertexBuffer.resource.Reset();
+    m_positionBuffer.resource.Reset();
     m_perFrameConstants.Reset();
     m_rayGenShaderTable.Reset();
+    m_checkerboardResolveShaderTable.Reset();
+    m_progressiveFillShaderTable.Reset();
     m_missShaderTable.Reset();
     m_hitGroupShaderTable.Reset();
+	m_perGeometryConstantsBuffer.Reset();
+	m_floorShadowCache.Reset();
+	m_floorShadowCacheClearHeap.Reset();
+	m_shadowRayStats.Reset();
+	m_shadowRayStatsReadback.Reset();
+	m_mappedShadowRayStats = nullptr;
+	m_textureFeedback.Reset();
+	m_textureFeedbackReset.Reset();
+	m_textureFeedbackReadback.Reset();
+	m_mappedTextureFeedback = nullptr;
+	for (auto& streamedTexture : m_streamedTextures)
+	{
+		streamedTexture.Resource.Reset();
+	}
+	for (auto& releases : m_textureReleases)
+	{
+		releases.clear();
+	}
 
     m_bottomLevelAccelerationStructure.Reset();
     m_topLevelAccelerationStructure.Reset();
@@ -954,11 +1942,25 @@ void VaporPlus::OnRender()
 	Draw2DTextToTexture(GetTextureInfo(TextureID_Text));
 
 	UpdateAnimation();
+	SceneSnapshot const& snapshot = CaptureSceneSnapshot();
+	UpdateProgressiveRefinement();
+	UpdateCheckerboard();
+	UpdatePrimaryHitCache(snapshot);
+	UpdateFloorShadowCache(snapshot);
+	UpdateTextureResidency();
 
     DoRaytracing();
 	DrawRaytracingOutputToTarget();
 
+	UINT presentedFrameIndex = m_deviceResources->GetCurrentFrameIndex();
     m_deviceResources->Present(D3D12_RESOURCE_STATE_PRESENT);
+	UpdateFrameLatency(presentedFrameIndex);
+
+	if (m_progressivePass < ProgressivePassCount)
+	{
+		CompleteProgressivePass();
+	}
+	UpdateInputLatency();
 }
 
 void VaporPlus::OnDestroy()
@@ -987,30 +1989,73 @@ void VaporPlus::CalculateFrameStats()
 {
     static int frameCnt = 0;
     static double elapsedTime = 0.0f;
+    static float retracedPixelFractionSum = 0.0f;
     double totalTime = m_timer.GetTotalSeconds();
     frameCnt++;
+    retracedPixelFractionSum += m_retracedPixelFraction;
 
     // Compute averages over one second period.
     if ((totalTime - elapsedTime) >= 1.0f)
     {
         float diff = static_cast<float>(totalTime - elapsedTime);
         float fps = static_cast<float>(frameCnt) / diff; // Normalize to an exact second.
+        float retracedPixelFraction = retracedPixelFractionSum / static_cast<float>(frameCnt);
 
         frameCnt = 0;
         elapsedTime = totalTime;
-
-        float MRaysPerSecond = (m_width * m_height * fps) / static_cast<float>(1e6);
+        retracedPixelFractionSum = 0.0f;
+
+        float checkerboardFraction = m_enableCheckerboard ? 0.5f : 1.0f;
+        float MRaysPerSecond = (m_raytracingWidth * m_raytracingHeight * checkerboardFraction * retracedPixelFraction * fps) / static_cast<float>(1e6);
+		float textPanelMs = static_cast<float>(m_textPanelTicks * 1000.0 / m_performanceFrequency.QuadPart / (fps * diff));
+		UINT textPanelRedraws = m_textPanelRedraws;
+		m_textPanelTicks = 0;
+		m_textPanelRedraws = 0;
+
+        // The text panel keeps to the two lines it has room for, the title adds what the resolution does to the
+        // ray count, and the rest goes to the debug output.
+        std::wstringstream panelText;
+		panelText << L"(DXR)";
+        panelText << std::setprecision(2) << std::fixed
+            << L"    fps: " << fps << L"     ~Million Primary Rays/s: " << MRaysPerSecond
+			<< "\n"
+            << L"    GPU[" << m_deviceResources->GetAdapterID() << L"]: " << m_deviceResources->GetAdapterDescription();
 
         std::wstringstream windowText;
-
 		windowText << L"(DXR)";
         windowText << std::setprecision(2) << std::fixed
             << L"    fps: " << fps << L"     ~Million Primary Rays/s: " << MRaysPerSecond
+            << L"     Retraced: " << retracedPixelFraction * 100.0f << L"%"
+            << L"     Traced at: " << m_raytracingWidth << L"x" << m_raytracingHeight
 			<< "\n"
             << L"    GPU[" << m_deviceResources->GetAdapterID() << L"]: " << m_deviceResources->GetAdapterDescription();
         SetCustomWindowText(windowText.str().c_str());
 
-		m_frameStatsText = windowText.str();
+		std::wstringstream debugText;
+		debugText << std::setprecision(2) << std::fixed;
+		if (m_enableFloorShadowCache)
+		{
+			debugText << L"Shadow rays per frame: " << m_shadowRaysTraced << L" traced, " << m_shadowRaysCached << L" from cache\n";
+		}
+		if (m_textureBudgetBytes != UINT64_MAX)
+		{
+			debugText << L"Textures: " << m_textureResidentBytes / 1024 << L" of " << m_textureBudgetBytes / 1024 << L" KB resident, finest mips "
+				<< m_streamedTextures[0].ResidentMip << L" and " << m_streamedTextures[1].ResidentMip << L", " << m_textureResidencyChanges << L" changes\n";
+		}
+		if (m_enableProgressiveRefinement)
+		{
+			debugText << L"Progressive refinement: first image " << m_progressiveFirstImageMs << L" ms, final " << m_progressiveFinalImageMs << L" ms\n";
+		}
+		debugText << L"Text panel: " << textPanelMs << L" ms CPU per frame, redrawn " << textPanelRedraws << L" times\n";
+		debugText << L"Input latency: " << m_inputLatencyMs << L" ms";
+		if (m_maxFrameLatency > 0)
+		{
+			debugText << L" (max frame latency " << m_maxFrameLatency << L")";
+		}
+		debugText << L", frame latency: " << m_frameLatencyMs << L" ms with " << m_framesInFlight << L" in flight\n";
+		OutputDebugStringW(debugText.str().c_str());
+
+		m_frameStatsText = panelText.str();
     }
 }
 
@@ -1022,22 +2067,65 @@ void VaporPlus::OnSizeChanged(UINT width, UINT height, bool minimized)
         return;
     }
 
+    OnInputChanged();
     UpdateForSizeChange(width, height);
 
     ReleaseWindowSizeDependentResources();
     CreateWindowSizeDependentResources();
 }
 
+// Called after each Present. Times every frame the GPU has finished since the last call, averaged over recent frames.
+void VaporPlus::UpdateFrameLatency(UINT presentedFrameIndex)
+{
+	static const float c_smoothing = 0.1f;
+
+	m_frameTimings[presentedFrameIndex].FenceValue = m_deviceResources->GetLastPresentedFenceValue();
+
+	LARGE_INTEGER performanceCounter;
+	QueryPerformanceCounter(&performanceCounter);
+	UINT64 completedFenceValue = m_deviceResources->GetCompletedFenceValue();
+
+	for (auto& frameTiming : m_frameTimings)
+	{
+		if (frameTiming.FenceValue == 0 || completedFenceValue < frameTiming.FenceValue)
+			continue;
+
+		float latencyMs = static_cast<float>(performanceCounter.QuadPart - frameTiming.StartTime.QuadPart) * 1000.0f / static_cast<float>(m_performanceFrequency.QuadPart);
+		m_frameLatencyMs = (m_frameLatencyMs == 0.0f) ? latencyMs : m_frameLatencyMs + (latencyMs - m_frameLatencyMs) * c_smoothing;
+		frameTiming.FenceValue = 0;
+	}
+}
+
+// Start timing from an input to the first frame that reflects it. A later input before that frame restarts the timing.
+void VaporPlus::OnInputChanged()
+{
+	m_inputPending = true;
+	m_inputFenceValue = 0;
+	QueryPerformanceCounter(&m_inputTime);
+}
+
+// Called after each Present. Picks up the frame built after a pending input, and times it once the GPU has finished it.
+void VaporPlus::UpdateInputLatency()
+{
+	if (m_inputPending)
+	{
+		m_inputPending = false;
+		m_inputFenceValue = m_deviceResources->GetLastPresentedFenceValue();
+	}
+
+	if (m_inputFenceValue != 0 && m_deviceResources->GetCompletedFenceValue() >= m_inputFenceValue)
+	{
+		LARGE_INTEGER performanceCounter;
+		QueryPerformanceCounter(&performanceCounter);
+		m_inputLatencyMs = static_cast<float>(performanceCounter.QuadPart - m_inputTime.QuadPart) * 1000.0f / static_cast<float>(m_performanceFrequency.QuadPart);
+		m_inputFenceValue = 0;
+	}
+}
+
 void VaporPlus::LoadTextures()
 {
 	CoInitialize(NULL);
 
-	ThrowIfFailed(CoCreateInstance(
-		CLSID_WICImagingFactory,
-		NULL,
-		CLSCTX_INPROC_SERVER,
-		IID_PPV_ARGS(&m_wicImagingFactory)));
-
 	uint32_t d3d11DeviceFlags = D3D11_CREATE_DEVICE_BGRA_SUPPORT;
 #ifdef DEBUG
 	d3d11DeviceFlags |= D3D11_CREATE_DEVICE_DEBUG;
@@ -1104,14 +2192,160 @@ void VaporPlus::LoadTextures()
 	ThrowIfFailed(m_d2dDevice->CreateDeviceContext(deviceOptions, &m_d2dDeviceContext));
 	ThrowIfFailed(m_d2dDeviceContext->CreateSolidColorBrush(D2D1::ColorF(0.44f, 0.99f, 0.73f, 1.0f), &m_cyanColorBrush));
 
-	m_allTextures.push_back(LoadImageTextureAsset(TextureID_Checkerboard, L"checker.png", &m_raytracingDescriptorHeap));
-	m_allTextures.push_back(LoadImageTextureAsset(TextureID_Cityscape, L"Cityscape.png", &m_raytracingDescriptorHeap));
-	m_allTextures.push_back(Create2DTargetTextureAsset(TextureID_Text));
-	m_allTextures.push_back(LoadImageTextureAsset(TextureID_TVNoise, L"TVNoise.png", m_postprocess.GetSRVHeap(), 1));
+	// Decode the images concurrently, then upload them all with one command list and one wait.
+	struct ImageAsset
+	{
+		TextureIdentifier TextureID;
+		wchar_t const* Filename;
+		bool Raytraced; // Gets mips for picking levels by ray cone, and BC1 compression with -compressTextures
+		DecodedImage Image;
+		ComPtr<ID3D12Resource> UploadHeap;
+	};
+	ImageAsset imageAssets[] =
+	{
+		{ TextureID_Checkerboard, L"checker.png", true },
+		{ TextureID_Cityscape, L"Cityscape.png", true },
+		{ TextureID_TVNoise, L"TVNoise.png", false },
+	};
+
+	LARGE_INTEGER decodeStart, decodeEnd;
+	QueryPerformanceCounter(&decodeStart);
+	{
+		TaskPool::TaskGroup decodeGroup;
+		for (auto& imageAsset : imageAssets)
+		{
+			bool compressBc1 = m_compressTextures && imageAsset.Raytraced;
+			m_taskPool->Run(&decodeGroup, [this, &imageAsset, compressBc1]()
+			{
+				DecodeImage(imageAsset.Filename, imageAsset.Raytraced, compressBc1, m_taskPool.get(), &imageAsset.Image);
+			});
+		}
+		m_taskPool->Wait(&decodeGroup);
+	}
+	QueryPerformanceCounter(&decodeEnd);
+
+	std::wstringstream message;
+	for (auto const& imageAsset : imageAssets)
+	{
+		message << L"Decoded " << imageAsset.Filename << L" (" << imageAsset.Image.Width << L"x" << imageAsset.Image.Height << L") in "
+			<< imageAsset.Image.DecodeMs << L" ms";
+		if (imageAsset.Image.ConvertMs > 0.0)
+		{
+			double convertedBytes = static_cast<double>(imageAsset.Image.Pixels.size() * sizeof(UINT));
+			message << L", pixel format conversion " << imageAsset.Image.ConvertMs << L" ms ("
+				<< convertedBytes / (imageAsset.Image.ConvertMs * 1e6) << L" GB/s)";
+		}
+		message << L"\n";
+		if (!imageAsset.Image.Bc1Levels.empty())
+		{
+			size_t uncompressedBytes = imageAsset.Image.Pixels.size() * sizeof(UINT);
+			size_t compressedBytes = 0;
+			for (UINT level = 0; level < imageAsset.Image.Bc1Levels.size(); ++level)
+			{
+				uncompressedBytes += level > 0 ? imageAsset.Image.LowerMips[level - 1].size() * sizeof(UINT) : 0;
+				compressedBytes += imageAsset.Image.Bc1Levels[level].size() * sizeof(UINT64);
+			}
+			message << L"  BC1 in " << imageAsset.Image.CompressMs << L" ms ("
+				<< imageAsset.Image.Pixels.size() / (imageAsset.Image.CompressMs * 1e3) << L" Mpixels/s), PSNR "
+				<< imageAsset.Image.Bc1Psnr << L" dB, " << compressedBytes / 1024 << L" KB instead of " << uncompressedBytes / 1024 << L" KB\n";
+		}
+	}
+	message << L"Decoded all images in " << (decodeEnd.QuadPart - decodeStart.QuadPart) * 1000 / m_performanceFrequency.QuadPart << L" ms\n";
+	OutputDebugStringW(message.str().c_str());
+
+	// The material texture tables. The streamed textures' SRVs differ between frame indices, see UpdateTextureResidency,
+	// and the text target's are all the same.
+	UINT materialTextureDescriptorIndices[FrameCount][MaterialTextureCount];
+	for (UINT n = 0; n < FrameCount; ++n)
+	{
+		for (UINT i = 0; i < MaterialTextureCount; ++i)
+		{
+			D3D12_CPU_DESCRIPTOR_HANDLE srvDescriptorHandle;
+			materialTextureDescriptorIndices[n][i] = m_raytracingDescriptorHeap.AllocateDescriptor(&srvDescriptorHandle);
+		}
+		m_materialTextureTableIndices[n] = materialTextureDescriptorIndices[n][0];
+	}
+
+	// The raytraced images start out with every level resident.
+	m_deviceResources->PrepareOffscreen();
+	for (UINT i = 0; i < StreamedTextureCount; ++i)
+	{
+		ImageAsset& imageAsset = imageAssets[i];
+		StreamedTexture& texture = m_streamedTextures[i];
+		texture.TextureID = imageAsset.TextureID;
+		texture.FeedbackOffset = i == 0 ? TEXTURE_FEEDBACK_CHECKERBOARD_OFFSET : TEXTURE_FEEDBACK_CITYSCAPE_OFFSET;
+		texture.Resource = CreateImageTexture(imageAsset.Image, 0, &imageAsset.UploadHeap);
+		texture.ResidentMip = 0;
+		texture.SampledMip = 0;
+		texture.LastSampledFrame = 0;
+
+		// BC1 levels need whole 4x4 blocks, which the coarsest few may not have.
+		texture.MaxResidentMip = static_cast<UINT>(imageAsset.Image.LowerMips.size());
+		while (!imageAsset.Image.Bc1Levels.empty() &&
+			(((imageAsset.Image.Width >> texture.MaxResidentMip) % 4) != 0 || ((imageAsset.Image.Height >> texture.MaxResidentMip) % 4) != 0))
+		{
+			--texture.MaxResidentMip;
+		}
+
+		for (UINT n = 0; n < FrameCount; ++n)
+		{
+			D3D12_CPU_DESCRIPTOR_HANDLE srvDescriptorHandle;
+			texture.DescriptorIndices[n] = m_raytracingDescriptorHeap.AllocateDescriptor(&srvDescriptorHandle, materialTextureDescriptorIndices[n][i]);
+			CreateImageTextureSRV(imageAsset.Image, 0, texture.Resource.Get(), srvDescriptorHandle);
+			texture.DescriptorGenerations[n] = 1;
+		}
+
+		TextureInfo textureInfo{};
+		textureInfo.TextureID = imageAsset.TextureID;
+		textureInfo.Filename = imageAsset.Filename;
+		textureInfo.Resource = texture.Resource;
+		textureInfo.ResourceDescriptor = CD3DX12_GPU_DESCRIPTOR_HANDLE(m_raytracingDescriptorHeap.GetGPUDescriptorHandleForHeapStart(), texture.DescriptorIndices[0], m_descriptorSize);
+		textureInfo.Generation = 1;
+		m_allTextures.push_back(textureInfo);
+	}
+	UINT textDescriptorIndices[FrameCount];
+	for (UINT n = 0; n < FrameCount; ++n)
+	{
+		textDescriptorIndices[n] = materialTextureDescriptorIndices[n][StreamedTextureCount];
+	}
+	m_allTextures.push_back(Create2DTargetTextureAsset(TextureID_Text, textDescriptorIndices));
+	m_allTextures.push_back(LoadImageTextureAsset(imageAssets[2].TextureID, imageAssets[2].Filename, imageAssets[2].Image, m_postprocess.GetSRVHeap(), &imageAssets[2].UploadHeap, 1));
+	m_deviceResources->ExecuteCommandList();
+	m_deviceResources->WaitForGpu();
+
+	// Kept to stream mip levels from, but only when there's a budget to stream under.
+	if (m_textureBudgetBytes != UINT64_MAX)
+	{
+		UINT64 allLevelsBytes = 0;
+		for (UINT i = 0; i < StreamedTextureCount; ++i)
+		{
+			allLevelsBytes += GetImageTextureBytes(imageAssets[i].Image, 0);
+			m_streamedTextures[i].Source = std::move(imageAssets[i].Image);
+		}
+
+		std::wstringstream budgetMessage;
+		budgetMessage << L"Streamed textures: " << allLevelsBytes / 1024 << L" KB with every level, budget " << m_textureBudgetBytes / 1024
+			<< L" KB (" << static_cast<double>(allLevelsBytes) / max(m_textureBudgetBytes, 1ull) << L"x)\n";
+		OutputDebugStringW(budgetMessage.str().c_str());
+	}
 }
 
-void VaporPlus::Draw2DTextToTexture(TextureInfo const& textTexture)
+void VaporPlus::Draw2DTextToTexture(TextureInfo& textTexture)
 {
+	LARGE_INTEGER drawStart, drawEnd;
+	QueryPerformanceCounter(&drawStart);
+
+	// Everything but the stats text, refreshed once a second, and the frame, toggled by a key, is fixed. When only
+	// the stats text has changed, only the band below statsTextTop is redrawn.
+	const float statsTextTop = 100.0f;
+	bool redrawAll = textTexture.Generation == 0 || m_drawnTextFrame != m_enableTextFrame;
+	if (!redrawAll && m_drawnFrameStatsText == m_frameStatsText)
+	{
+		QueryPerformanceCounter(&drawEnd);
+		m_textPanelTicks += drawEnd.QuadPart - drawStart.QuadPart;
+		return;
+	}
+
 	m_deviceResources->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
 		textTexture.Resource.Get(),
 		D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
@@ -1124,19 +2358,25 @@ void VaporPlus::Draw2DTextToTexture(TextureInfo const& textTexture)
 	ID3D11Resource* wrappedResources[] = { textTexture.Texture11.Get() };
 	m_device11on12->AcquireWrappedResources(wrappedResources, ARRAYSIZE(wrappedResources));
 
-	m_d2dDeviceContext->SetTarget(GetTextureInfo(TextureID_Text).Texture2DTarget.Get());
+	m_d2dDeviceContext->SetTarget(textTexture.Texture2DTarget.Get());
 	m_d2dDeviceContext->BeginDraw();
+
+	// Everything is drawn, so whatever reaches into the dirty band, like the frame, comes out whole, and the clip
+	// leaves what's outside the band as it was.
+	auto renderTargetSize = m_d2dDeviceContext->GetSize();
+	D2D1_RECT_F dirtyRect = D2D1::RectF(0, redrawAll ? 0 : statsTextTop, renderTargetSize.width, renderTargetSize.height);
+	m_d2dDeviceContext->PushAxisAlignedClip(dirtyRect, D2D1_ANTIALIAS_MODE_ALIASED);
+
 	m_d2dDeviceContext->Clear(D2D1::ColorF(1.0f, 0.51f, 0.61f, 1.0f));
 	m_d2dDeviceContext->DrawTextLayout(D2D1::Point2F(13, 37), m_topTextLayout.Get(), m_cyanColorBrush.Get());
 	m_d2dDeviceContext->DrawLine(D2D1::Point2F(0, 74), D2D1::Point2F(237, 74), m_cyanColorBrush.Get(), 10.0f);
 	m_d2dDeviceContext->DrawTextLayout(D2D1::Point2F(13, 80), m_bottomTextLayout.Get(), m_cyanColorBrush.Get());
 
-	auto renderTargetSize = m_d2dDeviceContext->GetSize();
 	m_d2dDeviceContext->DrawTextW(
 		m_frameStatsText.c_str(),
 		CheckCastUint(m_frameStatsText.size()),
 		m_statsTextFormat.Get(),
-		D2D1::RectF(5, 100, renderTargetSize.width, 500),
+		D2D1::RectF(5, statsTextTop, renderTargetSize.width, 500),
 		m_cyanColorBrush.Get());
 
 	if (m_enableTextFrame)
@@ -1145,6 +2385,7 @@ void VaporPlus::Draw2DTextToTexture(TextureInfo const& textTexture)
 		m_d2dDeviceContext->DrawRectangle(D2D1::RectF(margin, margin, renderTargetSize.width - margin, renderTargetSize.height - margin), m_cyanColorBrush.Get(), 2.0f);
 	}
 
+	m_d2dDeviceContext->PopAxisAlignedClip();
 	ThrowIfFailed(m_d2dDeviceContext->EndDraw());
 
 	m_d2dDeviceContext->SetTarget(nullptr);
@@ -1152,10 +2393,20 @@ void VaporPlus::Draw2DTextToTexture(TextureInfo const& textTexture)
 	m_device11on12->ReleaseWrappedResources(wrappedResources, ARRAYSIZE(wrappedResources));
 
 	m_deviceContext11->Flush();
+
+	++textTexture.Generation;
+	m_drawnFrameStatsText = m_frameStatsText;
+	m_drawnTextFrame = m_enableTextFrame;
+	++m_textPanelRedraws;
+
+	QueryPerformanceCounter(&drawEnd);
+	m_textPanelTicks += drawEnd.QuadPart - drawStart.QuadPart;
 }
 
+// Creates an SRV at each of descriptorIndices in the raytracing heap.
 VaporPlus::TextureInfo VaporPlus::Create2DTargetTextureAsset(
-	TextureIdentifier textureID)
+	TextureIdentifier textureID,
+	UINT const descriptorIndices[FrameCount])
 {
 	TextureInfo textureInfo{};
 	textureInfo.TextureID = textureID;
@@ -1192,26 +2443,41 @@ VaporPlus::TextureInfo VaporPlus::Create2DTargetTextureAsset(
 
 	auto device = m_deviceResources->GetD3DDevice();
 
-	D3D12_CPU_DESCRIPTOR_HANDLE srvDescriptorHandle;
-	UINT descriptorIndex = m_raytracingDescriptorHeap.AllocateDescriptor(&srvDescriptorHandle);
-	device->CreateShaderResourceView(textureInfo.Resource.Get(), &srvDesc, srvDescriptorHandle);
-	textureInfo.ResourceDescriptor = CD3DX12_GPU_DESCRIPTOR_HANDLE(m_raytracingDescriptorHeap.GetGPUDescriptorHandleForHeapStart(), descriptorIndex, m_descriptorSize);
+	for (UINT n = 0; n < FrameCount; ++n)
+	{
+		D3D12_CPU_DESCRIPTOR_HANDLE srvDescriptorHandle;
+		m_raytracingDescriptorHeap.AllocateDescriptor(&srvDescriptorHandle, descriptorIndices[n]);
+		device->CreateShaderResourceView(textureInfo.Resource.Get(), &srvDesc, srvDescriptorHandle);
+	}
+	textureInfo.ResourceDescriptor = CD3DX12_GPU_DESCRIPTOR_HANDLE(m_raytracingDescriptorHeap.GetGPUDescriptorHandleForHeapStart(), descriptorIndices[0], m_descriptorSize);
 
 	return textureInfo;
 }
 
-VaporPlus::TextureInfo VaporPlus::LoadImageTextureAsset(
-	TextureIdentifier textureID,
-	wchar_t const* filename,
-	DescriptorHeapWrapper* srvDescriptorHeap,
-	UINT descriptorIndexToUse)
+// Runs on task pool threads, so it uses its own WIC factory.
+void VaporPlus::DecodeImage(wchar_t const* filename, bool generateMips, bool compressBc1, TaskPool* taskPool, DecodedImage* image)
 {
-	TextureInfo textureInfo{};
-	textureInfo.TextureID = textureID;
-	textureInfo.Filename = filename;
+	// The thread that created the pool already has COM initialized single-threaded, and this fails harmlessly there.
+	struct ComScope
+	{
+		HRESULT Result;
+		ComScope() : Result(CoInitializeEx(nullptr, COINIT_MULTITHREADED)) {}
+		~ComScope() { if (SUCCEEDED(Result)) CoUninitialize(); }
+	} comScope;
+
+	LARGE_INTEGER performanceFrequency, decodeStart, decodeEnd;
+	QueryPerformanceFrequency(&performanceFrequency);
+	QueryPerformanceCounter(&decodeStart);
+
+	ComPtr<IWICImagingFactory> wicImagingFactory;
+	ThrowIfFailed(CoCreateInstance(
+		CLSID_WICImagingFactory,
+		NULL,
+		CLSCTX_INPROC_SERVER,
+		IID_PPV_ARGS(&wicImagingFactory)));
 
 	ComPtr<IWICBitmapDecoder> decoder;
-	ThrowIfFailed(m_wicImagingFactory->CreateDecoderFromFilename(
+	ThrowIfFailed(wicImagingFactory->CreateDecoderFromFilename(
 		filename,
 		NULL,
 		GENERIC_READ,
@@ -1224,46 +2490,148 @@ VaporPlus::TextureInfo VaporPlus::LoadImageTextureAsset(
 	WICPixelFormatGUID originalFormat;
 	ThrowIfFailed(source->GetPixelFormat(&originalFormat));
 
-	// Convert the image format to 32bppPBGRA, equiv to DXGI_FORMAT_B8G8R8A8_UNORM
-	CComPtr<IWICFormatConverter> converter;
-	ThrowIfFailed(m_wicImagingFactory->CreateFormatConverter(&converter));
-
-	BOOL canConvertTo32bppPBGRA = false;
-	ThrowIfFailed(converter->CanConvert(originalFormat, GUID_WICPixelFormat32bppPBGRA, &canConvertTo32bppPBGRA));
-	assert(canConvertTo32bppPBGRA);
-
-	ThrowIfFailed(converter->Initialize(
-		source,
-		GUID_WICPixelFormat32bppPBGRA,
-		WICBitmapDitherTypeNone,
-		NULL,
-		0.f,
-		WICBitmapPaletteTypeMedianCut
-	));
-
 	UINT width, height;
-	ThrowIfFailed(converter->GetSize(&width, &height));
+	ThrowIfFailed(source->GetSize(&width, &height));
 	const UINT bpp = 4;
 	const UINT pitch = bpp * width;
 
-	std::vector<UINT> imageData;
-	imageData.resize(width * height);
+	image->Width = width;
+	image->Height = height;
+	image->Pixels.resize(width * height);
+	image->ConvertMs = 0.0;
 
-	ThrowIfFailed(converter->CopyPixels(NULL, pitch, bpp * width * height, reinterpret_cast<BYTE*>(&(imageData[0]))));
+	PixelFormat::Source sourceFormat;
+	if (PixelFormat::FromWicFormat(originalFormat, &sourceFormat))
+	{
+		// Copy out the pixels as decoded, and convert them to 32bppPBGRA ourselves.
+		const UINT sourcePitch = PixelFormat::GetBytesPerPixel(sourceFormat) * width;
+		std::vector<BYTE> sourcePixels(sourcePitch * height);
+		ThrowIfFailed(source->CopyPixels(NULL, sourcePitch, sourcePitch * height, &sourcePixels[0]));
+
+		LARGE_INTEGER convertStart, convertEnd;
+		QueryPerformanceCounter(&convertStart);
+		PixelFormat::ConvertToPremultipliedBgra8(sourceFormat, &sourcePixels[0], &image->Pixels[0], image->Pixels.size());
+		QueryPerformanceCounter(&convertEnd);
+		image->ConvertMs = static_cast<double>(convertEnd.QuadPart - convertStart.QuadPart) * 1000.0 / static_cast<double>(performanceFrequency.QuadPart);
+	}
+	else
+	{
+		// Convert the image format to 32bppPBGRA, equiv to DXGI_FORMAT_B8G8R8A8_UNORM
+		CComPtr<IWICFormatConverter> converter;
+		ThrowIfFailed(wicImagingFactory->CreateFormatConverter(&converter));
+
+		BOOL canConvertTo32bppPBGRA = false;
+		ThrowIfFailed(converter->CanConvert(originalFormat, GUID_WICPixelFormat32bppPBGRA, &canConvertTo32bppPBGRA));
+		assert(canConvertTo32bppPBGRA);
+
+		ThrowIfFailed(converter->Initialize(
+			source,
+			GUID_WICPixelFormat32bppPBGRA,
+			WICBitmapDitherTypeNone,
+			NULL,
+			0.f,
+			WICBitmapPaletteTypeMedianCut
+		));
+
+		ThrowIfFailed(converter->CopyPixels(NULL, pitch, bpp * width * height, reinterpret_cast<BYTE*>(&(image->Pixels[0]))));
+	}
+
+	image->LowerMips.clear();
+	if (generateMips)
+	{
+		UINT mipWidth = width;
+		UINT mipHeight = height;
+		UINT const* mipPixels = &image->Pixels[0];
+		for (UINT level = 1; level < PixelFormat::GetMipLevelCount(width, height); ++level)
+		{
+			UINT nextWidth = max(mipWidth / 2, 1u);
+			UINT nextHeight = max(mipHeight / 2, 1u);
+			image->LowerMips.emplace_back(nextWidth * nextHeight);
+			PixelFormat::DownsampleBgra8(mipPixels, mipWidth, mipHeight, &image->LowerMips.back()[0]);
+
+			mipWidth = nextWidth;
+			mipHeight = nextHeight;
+			mipPixels = &image->LowerMips.back()[0];
+		}
+	}
 
-	// Create the output resource. The dimensions and format should match the swap-chain.
-	auto textureDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_B8G8R8A8_UNORM, width, height, 1, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+	QueryPerformanceCounter(&decodeEnd);
+	image->DecodeMs = static_cast<double>(decodeEnd.QuadPart - decodeStart.QuadPart) * 1000.0 / static_cast<double>(performanceFrequency.QuadPart);
+
+	image->Bc1Levels.clear();
+	image->CompressMs = 0.0;
+	image->Bc1Psnr = 0.0;
+	if (compressBc1)
+	{
+		// BC1 would lose the alpha, and D3D12 needs the top level to be whole blocks.
+		bool opaque = true;
+		for (UINT pixel : image->Pixels)
+		{
+			opaque = opaque && (pixel >> 24) == 0xFF;
+		}
+		if (!opaque || width % 4 != 0 || height % 4 != 0)
+		{
+			std::wstringstream message;
+			message << L"Not compressing " << filename << L": BC1 needs an opaque image with a size in multiples of 4\n";
+			OutputDebugStringW(message.str().c_str());
+			return;
+		}
+
+		LARGE_INTEGER compressStart, compressEnd;
+		QueryPerformanceCounter(&compressStart);
+		image->Bc1Levels.resize(1 + image->LowerMips.size());
+		for (UINT level = 0; level < image->Bc1Levels.size(); ++level)
+		{
+			UINT const* levelPixels = level == 0 ? &image->Pixels[0] : &image->LowerMips[level - 1][0];
+			BlockCompression::EncodeBc1(levelPixels, max(width >> level, 1u), max(height >> level, 1u), taskPool, &image->Bc1Levels[level]);
+		}
+		QueryPerformanceCounter(&compressEnd);
+		image->CompressMs = static_cast<double>(compressEnd.QuadPart - compressStart.QuadPart) * 1000.0 / static_cast<double>(performanceFrequency.QuadPart);
+
+		std::vector<UINT> decodedPixels(image->Pixels.size());
+		BlockCompression::DecodeBc1(&image->Bc1Levels[0][0], width, height, &decodedPixels[0]);
+		image->Bc1Psnr = BlockCompression::ComputePsnr(&decodedPixels[0], &image->Pixels[0], image->Pixels.size());
+	}
+}
+
+UINT64 VaporPlus::GetImageTextureBytes(DecodedImage const& image, UINT firstMip)
+{
+	UINT64 bytes = 0;
+	for (UINT level = firstMip; level < 1 + image.LowerMips.size(); ++level)
+	{
+		UINT mipWidth = max(image.Width >> level, 1u);
+		UINT mipHeight = max(image.Height >> level, 1u);
+		bytes += image.Bc1Levels.empty()
+			? static_cast<UINT64>(mipWidth) * mipHeight * sizeof(UINT)
+			: static_cast<UINT64>(BlockCompression::GetBlockCount(mipWidth)) * BlockCompression::GetBlockCount(mipHeight) * sizeof(UINT64);
+	}
+	return bytes;
+}
+
+// Creates a texture of image's mip levels from firstMip on, and records their upload into the current command list.
+// uploadHeap has to be kept until that has run.
+ComPtr<ID3D12Resource> VaporPlus::CreateImageTexture(DecodedImage const& image, UINT firstMip, ComPtr<ID3D12Resource>* uploadHeap)
+{
+	UINT width = max(image.Width >> firstMip, 1u);
+	UINT height = max(image.Height >> firstMip, 1u);
+	const UINT bpp = 4;
+	const UINT16 mipLevels = static_cast<UINT16>(1 + image.LowerMips.size() - firstMip);
+	const bool compressed = !image.Bc1Levels.empty();
+	const DXGI_FORMAT format = compressed ? DXGI_FORMAT_BC1_UNORM : DXGI_FORMAT_B8G8R8A8_UNORM;
+
+	// Create the texture. It's only ever copied into and sampled, so it has no flags: UAV access would keep some
+	// drivers from using their swizzled, compressed layouts, which keep 2D neighborhoods of texels together in memory.
+	auto textureDesc = CD3DX12_RESOURCE_DESC::Tex2D(format, width, height, 1, mipLevels, 1, 0, D3D12_RESOURCE_FLAG_NONE, D3D12_TEXTURE_LAYOUT_UNKNOWN);
 
 	auto device = m_deviceResources->GetD3DDevice();
 
+	ComPtr<ID3D12Resource> texture;
 	auto defaultHeapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
 	ThrowIfFailed(device->CreateCommittedResource(
-		&defaultHeapProperties, D3D12_HEAP_FLAG_NONE, &textureDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&textureInfo.Resource)));
-	NAME_D3D12_OBJECT(textureInfo.Resource);
-
-	const UINT64 uploadBufferSize = GetRequiredIntermediateSize(textureInfo.Resource.Get(), 0, 1);
+		&defaultHeapProperties, D3D12_HEAP_FLAG_NONE, &textureDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&texture)));
+	NAME_D3D12_OBJECT(texture);
 
-	ComPtr<ID3D12Resource> textureUploadHeap;
+	const UINT64 uploadBufferSize = GetRequiredIntermediateSize(texture.Get(), 0, mipLevels);
 
 	// Create the GPU upload buffer.
 	ThrowIfFailed(device->CreateCommittedResource(
@@ -1272,33 +2640,66 @@ VaporPlus::TextureInfo VaporPlus::LoadImageTextureAsset(
 		&CD3DX12_RESOURCE_DESC::Buffer(uploadBufferSize),
 		D3D12_RESOURCE_STATE_GENERIC_READ,
 		nullptr,
-		IID_PPV_ARGS(&textureUploadHeap)));
+		IID_PPV_ARGS(uploadHeap->ReleaseAndGetAddressOf())));
 
-	D3D12_SUBRESOURCE_DATA textureData = {};
-	textureData.pData = &imageData[0];
-	textureData.RowPitch = width * bpp;
-	textureData.SlicePitch = textureData.RowPitch * height;
+	std::vector<D3D12_SUBRESOURCE_DATA> textureData(mipLevels);
+	for (UINT subresource = 0; subresource < mipLevels; ++subresource)
+	{
+		UINT level = firstMip + subresource;
+		UINT mipWidth = max(image.Width >> level, 1u);
+		UINT mipHeight = max(image.Height >> level, 1u);
+		if (compressed)
+		{
+			// Rows of 4x4 blocks, 8 bytes each
+			textureData[subresource].pData = &image.Bc1Levels[level][0];
+			textureData[subresource].RowPitch = BlockCompression::GetBlockCount(mipWidth) * sizeof(UINT64);
+			textureData[subresource].SlicePitch = textureData[subresource].RowPitch * BlockCompression::GetBlockCount(mipHeight);
+		}
+		else
+		{
+			textureData[subresource].pData = level == 0 ? &image.Pixels[0] : &image.LowerMips[level - 1][0];
+			textureData[subresource].RowPitch = mipWidth * bpp;
+			textureData[subresource].SlicePitch = textureData[subresource].RowPitch * mipHeight;
+		}
+	}
 
-	// Describe and create a SRV for the texture.
+	UpdateSubresources(m_deviceResources->GetCommandList(), texture.Get(), uploadHeap->Get(), 0, 0, mipLevels, &textureData[0]);
+	m_deviceResources->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(texture.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
+
+	return texture;
+}
+
+void VaporPlus::CreateImageTextureSRV(DecodedImage const& image, UINT firstMip, ID3D12Resource* resource, D3D12_CPU_DESCRIPTOR_HANDLE srvDescriptorHandle)
+{
 	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
 	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-	srvDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+	srvDesc.Format = image.Bc1Levels.empty() ? DXGI_FORMAT_B8G8R8A8_UNORM : DXGI_FORMAT_BC1_UNORM;
 	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-	srvDesc.Texture2D.MipLevels = 1;
+	srvDesc.Texture2D.MipLevels = static_cast<UINT>(1 + image.LowerMips.size() - firstMip);
+	m_deviceResources->GetD3DDevice()->CreateShaderResourceView(resource, &srvDesc, srvDescriptorHandle);
+}
 
+// Records the upload into the current command list. uploadHeap has to be kept until that has run.
+VaporPlus::TextureInfo VaporPlus::LoadImageTextureAsset(
+	TextureIdentifier textureID,
+	wchar_t const* filename,
+	DecodedImage const& image,
+	DescriptorHeapWrapper* srvDescriptorHeap,
+	ComPtr<ID3D12Resource>* uploadHeap,
+	UINT descriptorIndexToUse)
+{
+	TextureInfo textureInfo{};
+	textureInfo.TextureID = textureID;
+	textureInfo.Filename = filename;
+	textureInfo.Resource = CreateImageTexture(image, 0, uploadHeap);
+	textureInfo.Generation = 1;
+
+	// Describe and create a SRV for the texture.
 	D3D12_CPU_DESCRIPTOR_HANDLE srvDescriptorHandle;
 	UINT descriptorIndex = srvDescriptorHeap->AllocateDescriptor(&srvDescriptorHandle, descriptorIndexToUse);
-	device->CreateShaderResourceView(textureInfo.Resource.Get(), &srvDesc, srvDescriptorHandle);
+	CreateImageTextureSRV(image, 0, textureInfo.Resource.Get(), srvDescriptorHandle);
 	textureInfo.ResourceDescriptor = CD3DX12_GPU_DESCRIPTOR_HANDLE(srvDescriptorHeap->GetGPUDescriptorHandleForHeapStart(), descriptorIndex, m_descriptorSize);
 
-	m_deviceResources->PrepareOffscreen();
-
-	UpdateSubresources(m_deviceResources->GetCommandList(), textureInfo.Resource.Get(), textureUploadHeap.Get(), 0, 0, 1, &textureData);
-	m_deviceResources->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(textureInfo.Resource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
-
-	m_deviceResources->ExecuteCommandList();
-	m_deviceResources->WaitForGpu();
-
 	return textureInfo;
 }
 
@@ -7,6 +7,7 @@
 #include "GeometryObject.h"
 #include "DescriptorHeapWrapper.h"
 #include "Postprocess.h"
+#include "TaskPool.h"
 
 namespace GlobalRootSignatureParams {
     enum Value {
@@ -14,10 +15,14 @@ namespace GlobalRootSignatureParams {
         AccelerationStructureSlot,
         SceneConstantSlot,
         VertexBuffersSlot,
-		CheckerboardTextureSlot,
+		MaterialTexturesSlot,
 		SamplerSlot,
-		CityscapeTextureSlot,
-		TextTextureSlot,
+		TileOrderSlot,
+		PerGeometryConstantsSlot,
+		PrimaryHitCacheSlot,
+		FloorShadowCacheSlot,
+		ShadowRayStatsSlot,
+		TextureFeedbackSlot,
         Count 
     };
 }
@@ -52,12 +57,12 @@ private:
     static const UINT FrameCount = 3;
 
     // We'll allocate space for several of these and they will need to be padded for alignment.
-	static_assert(sizeof(SceneConstantBuffer) < (2 * D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT), "Checking the size here.");
+	static_assert(sizeof(SceneConstantBuffer) < (3 * D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT), "Checking the size here.");
 
     union AlignedSceneConstantBuffer
     {
         SceneConstantBuffer constants;
-        uint8_t alignmentPadding[2 * D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT];
+        uint8_t alignmentPadding[3 * D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT];
     };
     AlignedSceneConstantBuffer*  m_mappedConstantData;
     ComPtr<ID3D12Resource>       m_perFrameConstants;
@@ -69,13 +74,18 @@ private:
 	ComPtr<ID2D1Device> m_d2dDevice;
 	ComPtr<ID2D1DeviceContext> m_d2dDeviceContext;
 	ComPtr<ID3D11On12Device> m_device11on12;
-	ComPtr<IWICImagingFactory> m_wicImagingFactory;
 	ComPtr<ID2D1SolidColorBrush> m_cyanColorBrush;
 	ComPtr<IDWriteFactory> m_dwriteFactory;
 	ComPtr<IDWriteTextFormat> m_topTextFormat, m_bottomTextFormat, m_statsTextFormat;
 	ComPtr<IDWriteTextLayout> m_topTextLayout, m_bottomTextLayout;
 	std::wstring m_frameStatsText;
 
+	// What the text texture was last drawn with. It's only redrawn when these change.
+	std::wstring m_drawnFrameStatsText;
+	bool m_drawnTextFrame = false;
+	LONGLONG m_textPanelTicks = 0; // CPU time in Draw2DTextToTexture since the stats were last computed
+	UINT m_textPanelRedraws = 0;
+
     // DirectX Raytracing (DXR) attributes
     ComPtr<ID3D12Device5> m_dxrDevice;
     ComPtr<ID3D12GraphicsCommandList5> m_dxrCommandList;
@@ -97,11 +107,64 @@ private:
 		ComPtr<ID3D12Resource> Resource;
 		D3D12_GPU_DESCRIPTOR_HANDLE ResourceDescriptor;
 
+		// Bumped whenever the content or the resource holding it changes, so 0 until there is any.
+		UINT Generation;
+
 		ComPtr<ID3D11Texture2D> Texture11;
 		ComPtr<ID2D1Bitmap1> Texture2DTarget;
 	};
 	std::vector<TextureInfo> m_allTextures;
 
+	// An image file decoded to 32bpp premultiplied BGRA
+	struct DecodedImage
+	{
+		UINT Width;
+		UINT Height;
+		std::vector<UINT> Pixels;
+		double DecodeMs;
+		double ConvertMs; // Zero when WIC did the conversion
+		std::vector<std::vector<UINT>> LowerMips; // Mip levels 1 and up, if generated
+
+		// BC1 blocks for every mip level, if compressed, which are uploaded instead of the pixels
+		std::vector<std::vector<UINT64>> Bc1Levels;
+		double CompressMs;
+		double Bc1Psnr; // Of the top level, in dB
+	};
+
+	// The raytraced image textures are streamed: the GPU only holds the mip levels that shading has asked for and
+	// that fit in m_textureBudgetBytes, see UpdateTextureResidency. The rest are sampled at the finest level held.
+	struct StreamedTexture
+	{
+		TextureIdentifier TextureID;
+		UINT FeedbackOffset;
+		DecodedImage Source; // Every level, kept in system memory to stream from when there's a budget
+		UINT MaxResidentMip; // The coarsest level a texture can start at
+		UINT ResidentMip; // The finest level the GPU holds
+		UINT SampledMip; // The finest level last sampled
+		UINT64 LastSampledFrame;
+		ComPtr<ID3D12Resource> Resource;
+
+		// An SRV per frame index, rewritten when that frame index comes around after the texture's generation has changed
+		UINT DescriptorIndices[FrameCount];
+		UINT DescriptorGenerations[FrameCount];
+	};
+	static const UINT StreamedTextureCount = 2;
+
+	// The checkerboard, cityscape and text textures are bound as one descriptor table per frame index, in that order.
+	static const UINT MaterialTextureCount = 3;
+	UINT m_materialTextureTableIndices[FrameCount];
+	StreamedTexture m_streamedTextures[StreamedTextureCount];
+	UINT64 m_textureBudgetBytes; // UINT64_MAX without -textureBudget
+	UINT64 m_textureResidentBytes;
+	UINT m_textureResidencyChanges;
+	std::vector<ComPtr<ID3D12Resource>> m_textureReleases[FrameCount]; // Released when the frame index comes around
+
+	// Finest mip level each streamed texture was sampled at, reset every frame and copied to a readback slot
+	ComPtr<ID3D12Resource> m_textureFeedback;
+	ComPtr<ID3D12Resource> m_textureFeedbackReset;
+	ComPtr<ID3D12Resource> m_textureFeedbackReadback;
+	UINT* m_mappedTextureFeedback;
+
 	DescriptorHeapWrapper m_raytracingDescriptorHeap;
 	
 	// Raytracing scene
@@ -110,6 +173,7 @@ private:
 
     D3DBuffer m_indexBuffer;
     D3DBuffer m_vertexBuffer;
+    D3DBuffer m_positionBuffer;
     int m_totalVertexCount;
 
 	GeometryObject m_floor;
@@ -117,6 +181,21 @@ private:
 	GeometryObject m_cityscape;
 	GeometryObject m_text;
 
+	// The objects in geometry ID order, and the IDs of the ones UpdateAnimation moves
+	static const UINT GeometryCount = 4;
+	GeometryObject* const m_geometryObjects[GeometryCount] = { &m_floor, &m_helios, &m_cityscape, &m_text };
+	static const UINT MovingObjectCount = 3;
+	const UINT m_movingGeometryIDs[MovingObjectCount] = { 1, 2, 3 };
+
+	// What a frame reads about the animated scene. Captured once per frame after UpdateAnimation and only read
+	// after that, so every pass set up for the frame agrees on where the objects are.
+	struct SceneSnapshot
+	{
+		XMMATRIX TracedTransforms[GeometryCount]; // What the BLAS was last refit with
+		XMMATRIX LatestTransforms[GeometryCount]; // Uploaded for the next refit
+	};
+	SceneSnapshot m_sceneSnapshot;
+
 	D3D12_GPU_DESCRIPTOR_HANDLE m_samplerDescriptor;
 
     // Acceleration structure
@@ -130,15 +209,79 @@ private:
     D3D12_GPU_DESCRIPTOR_HANDLE m_raytracingOutputResourceUAVGpuDescriptor;
 	UINT m_raytracingOutputResourceUAVDescriptorHeapIndexDuringRaytracing;
 
+	// Rays are traced into the top-left raytracingWidth x raytracingHeight part of the output, which is
+	// smaller than the window while the postprocess blur would hide the lost detail anyway.
+	UINT m_raytracingWidth;
+	UINT m_raytracingHeight;
+
+	// Ray generation tiles, in dispatch order. One per frame, so the traced resolution can change without
+	// waiting for frames in flight that still use the old order.
+	struct TileOrder
+	{
+		ComPtr<ID3D12Resource> Buffer;
+		UINT TileCount;
+		UINT Width;
+		UINT Height;
+	};
+	TileOrder m_tileOrders[FrameCount];
+
+	// Resolution governor. Scales the traced resolution to hold a frame time budget.
+	bool m_enableResolutionGovernor;
+	float m_targetFrameTimeMs;
+	float m_smoothedFrameTimeMs;
+	float m_resolutionScale;
+	UINT m_framesSinceResolutionChange;
+
+	// Progressive refinement. After the traced resolution changes, the first frames trace one pixel per 8x8, 4x4
+	// and then 2x2 square, filling in the rest, so something is on screen before a full frame has been traced.
+	static const UINT ProgressivePassCount = 4;
+	bool m_enableProgressiveRefinement;
+	UINT m_progressivePass; // ProgressivePassCount once refinement has finished
+	LARGE_INTEGER m_progressiveStartTime;
+	float m_progressiveFirstImageMs;
+	float m_progressiveFinalImageMs;
+
+	// Primary hits recorded per pixel. With the camera fixed, pixels outside the screen bounds of the moving
+	// objects reshade their cached hit instead of tracing the primary ray again.
+	ComPtr<ID3D12Resource> m_primaryHitCache;
+	ComPtr<ID3D12Resource> m_perGeometryConstantsBuffer;
+	UINT m_primaryHitCacheFilledParities; // Bit n set once every pixel with (x + y) % 2 == n has recorded a hit
+	XMFLOAT4 m_previousRetraceBounds[MovingObjectCount];
+	float m_retracedPixelFraction;
+
+	// Floor shadowing cached per texel over the floor's top face. The light and floor are static, so only
+	// texels a moving object's shadow can reach are cleared each frame.
+	ComPtr<ID3D12Resource> m_floorShadowCache;
+	ComPtr<ID3D12DescriptorHeap> m_floorShadowCacheClearHeap; // Non-shader-visible UAV, as ClearUnorderedAccessViewUint requires
+	D3D12_GPU_DESCRIPTOR_HANDLE m_floorShadowCacheUAVGpuDescriptor;
+	XMFLOAT4 m_floorShadowCacheBounds;
+	float m_floorTopY;
+	bool m_floorShadowCacheCleared;
+	XMFLOAT4 m_previousFloorShadowBounds[MovingObjectCount];
+	std::vector<D3D12_RECT> m_floorShadowCacheClearRects;
+
+	// Running shadow ray totals, copied to a readback slot per frame
+	ComPtr<ID3D12Resource> m_shadowRayStats;
+	ComPtr<ID3D12Resource> m_shadowRayStatsReadback;
+	UINT* m_mappedShadowRayStats;
+	bool m_shadowRayStatsPending[FrameCount]; // Whether the frame index's readback slot was copied to
+	UINT m_shadowRayTotals[2];
+	UINT m_shadowRaysTraced;
+	UINT m_shadowRaysCached;
+
     // Shader tables
-    static const wchar_t* c_hitGroupName;
+    static const wchar_t* c_hitGroupNames[MATERIAL_COUNT];
     static const wchar_t* c_raygenShaderName;
-    static const wchar_t* c_closestHitShaderName;
+    static const wchar_t* c_checkerboardResolveShaderName;
+    static const wchar_t* c_progressiveFillShaderName;
+    static const wchar_t* c_closestHitShaderNames[MATERIAL_COUNT];
     static const wchar_t* c_missShaderName;
 	static const wchar_t* c_missShaderName_Shadow;
     ComPtr<ID3D12Resource> m_missShaderTable;
     ComPtr<ID3D12Resource> m_hitGroupShaderTable;
     ComPtr<ID3D12Resource> m_rayGenShaderTable;
+    ComPtr<ID3D12Resource> m_checkerboardResolveShaderTable;
+    ComPtr<ID3D12Resource> m_progressiveFillShaderTable;
 	uint32_t m_hitGroupShaderRecordCount;
 	uint32_t m_missShaderRecordCount;
     
@@ -148,17 +291,44 @@ private:
     XMVECTOR m_eye;
     XMVECTOR m_at;
     XMVECTOR m_up;
+	XMMATRIX m_viewProj;
 	bool m_enableTextFrame = false;
 	bool m_enablePostprocess = false;
+	bool m_enablePrimaryHitCache = false;
+	bool m_enableFloorShadowCache = false;
+	bool m_enableCheckerboard = false;
+	UINT m_checkerboardParity = 0;
+	bool m_checkerboardHistoryValid = false;
 	float m_floorTextureOffsetX = 0;
 	float m_floorTextureOffsetY = 0;
 
 	LARGE_INTEGER m_performanceCounter;
 	LARGE_INTEGER m_performanceFrequency;
 
+	// Latency from a key press or resize to the GPU finishing the first frame built after it
+	UINT m_maxFrameLatency;
+	bool m_inputPending;
+	LARGE_INTEGER m_inputTime;
+	UINT64 m_inputFenceValue; // 0 while no frame is being waited on
+	float m_inputLatencyMs;
+
+	// Latency from the start of a frame's update to the GPU finishing it, per frame index
+	UINT m_framesInFlight;
+	struct FrameTiming
+	{
+		LARGE_INTEGER StartTime;
+		UINT64 FenceValue; // 0 once the frame has been timed
+	};
+	FrameTiming m_frameTimings[FrameCount];
+	float m_frameLatencyMs;
+
 	// Asset loader
 	ObjLoader m_objLoader;
 
+	// Worker threads for CPU-side loading, only while CreateDeviceDependentResources loads assets
+	std::unique_ptr<TaskPool> m_taskPool;
+	bool m_compressTextures;
+
 	// Postprocess resources
 	Postprocess m_postprocess;
 
@@ -178,6 +348,22 @@ private:
     void CreateRaytracingPipelineStateObject();
     void CreateDescriptorHeaps();
     void CreateRaytracingOutputResource();
+	void BuildTileOrder(TileOrder* tileOrder);
+	UINT GetRaytracingResolutionDivisor() const;
+	void UpdateRaytracingResolution();
+	void UpdateResolutionGovernor();
+	void InvalidatePrimaryHitCache();
+	void CreatePrimaryHitCache();
+	SceneSnapshot const& CaptureSceneSnapshot();
+	void UpdatePrimaryHitCache(SceneSnapshot const& snapshot);
+	XMFLOAT4 GetScreenBounds(GeometryObject const& geometryObject, XMMATRIX const& transform) const;
+	void CreateFloorShadowCache();
+	void UpdateFloorShadowCache(SceneSnapshot const& snapshot);
+	void UpdateCheckerboard();
+	void RestartProgressiveRefinement();
+	void UpdateProgressiveRefinement();
+	void CompleteProgressivePass();
+	XMFLOAT4 GetFloorShadowBounds(GeometryObject const& geometryObject, XMMATRIX const& transform) const;
 	void CreateSampler();
     void BuildGeometry();
     void BuildAccelerationStructures();
@@ -186,18 +372,29 @@ private:
     void UpdateForSizeChange(UINT clientWidth, UINT clientHeight);
 	void DrawRaytracingOutputToTarget();
     void CalculateFrameStats();
+	void OnInputChanged();
+	void UpdateInputLatency();
+	void UpdateFrameLatency(UINT presentedFrameIndex);
 
 	void LoadTextures();
+	void CreateTextureFeedback();
+	void UpdateTextureResidency();
 
 	void UpdateAnimation();
 
+	static void DecodeImage(wchar_t const* filename, bool generateMips, bool compressBc1, TaskPool* taskPool, DecodedImage* image);
+	static UINT64 GetImageTextureBytes(DecodedImage const& image, UINT firstMip);
+	ComPtr<ID3D12Resource> CreateImageTexture(DecodedImage const& image, UINT firstMip, ComPtr<ID3D12Resource>* uploadHeap);
+	void CreateImageTextureSRV(DecodedImage const& image, UINT firstMip, ID3D12Resource* resource, D3D12_CPU_DESCRIPTOR_HANDLE srvDescriptorHandle);
 	TextureInfo LoadImageTextureAsset(
 		TextureIdentifier textureID,
 		wchar_t const* filename,
+		DecodedImage const& image,
 		DescriptorHeapWrapper* srvDescriptorHeap,
+		ComPtr<ID3D12Resource>* uploadHeap,
 		UINT descriptorIndexToUse = UINT_MAX);
 
-	TextureInfo Create2DTargetTextureAsset(TextureIdentifier textureID);
+	TextureInfo Create2DTargetTextureAsset(TextureIdentifier textureID, UINT const descriptorIndices[FrameCount]);
 	TextureInfo& GetTextureInfo(TextureIdentifier textureID);
-	void Draw2DTextToTexture(TextureInfo const& textTexture);
+	void Draw2DTextToTexture(TextureInfo& textTexture);
 };
@@ -18,6 +18,11 @@
 #include <memory>
 #include <unordered_map>
 #include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 #include <atlbase.h>
 #include <assert.h>
 #include <fstream>
@@ -0,0 +1,79 @@
+#include "stdafx.h"
+#include "BlockCompression.h"
+#include "TaskPool.h"
+#include "Tests.h"
+#include <cmath>
+
+static UINT PackBgr(UINT b, UINT g, UINT r)
+{
+	return b | (g << 8) | (r << 16) | 0xFF000000;
+}
+
+static double EncodeAndMeasurePsnr(std::vector<UINT> const& pixels, UINT width, UINT height, TaskPool* taskPool)
+{
+	std::vector<UINT64> blocks;
+	BlockCompression::EncodeBc1(pixels.data(), width, height, taskPool, &blocks);
+	CHECK(blocks.size() == BlockCompression::GetBlockCount(width) * BlockCompression::GetBlockCount(height));
+
+	std::vector<UINT> decoded(width * height);
+	BlockCompression::DecodeBc1(blocks.data(), width, height, decoded.data());
+	return BlockCompression::ComputePsnr(decoded.data(), pixels.data(), pixels.size());
+}
+
+void Tests::RunBlockCompressionTests()
+{
+	printf("BC1 encoding\n");
+
+	CHECK(BlockCompression::GetBlockCount(1) == 1);
+	CHECK(BlockCompression::GetBlockCount(4) == 1);
+	CHECK(BlockCompression::GetBlockCount(5) == 2);
+
+	// Two colors that 5:6:5 holds exactly, alternating within every block, come back unchanged.
+	{
+		const UINT width = 64, height = 64;
+		std::vector<UINT> pixels(width * height);
+		for (UINT y = 0; y < height; ++y)
+		{
+			for (UINT x = 0; x < width; ++x)
+			{
+				pixels[y * width + x] = ((x + y) & 1) ? PackBgr(0xFF, 0, 0) : PackBgr(0, 0xFF, 0xFF);
+			}
+		}
+		CHECK(std::isinf(EncodeAndMeasurePsnr(pixels, width, height, nullptr)));
+	}
+
+	// A smooth gradient, and the same at a size with partial blocks at the right and bottom.
+	for (UINT size : { 256u, 250u })
+	{
+		UINT width = size, height = size * 2 / 3;
+		std::vector<UINT> pixels(width * height);
+		for (UINT y = 0; y < height; ++y)
+		{
+			for (UINT x = 0; x < width; ++x)
+			{
+				pixels[y * width + x] = PackBgr(x * 255 / width, y * 255 / height, (x + y) * 127 / (width + height));
+			}
+		}
+		double psnr = EncodeAndMeasurePsnr(pixels, width, height, nullptr);
+		printf("  %ux%u gradient: %.2f dB\n", width, height, psnr);
+		CHECK(psnr > 35.0);
+	}
+
+	// The block rows spread over a pool encode the same as on one thread.
+	{
+		const UINT width = 512, height = 256;
+		std::vector<UINT> pixels(width * height);
+		UINT state = 1;
+		for (UINT& pixel : pixels)
+		{
+			state = state * 1664525 + 1013904223;
+			pixel = state | 0xFF000000;
+		}
+
+		std::vector<UINT64> serialBlocks, parallelBlocks;
+		BlockCompression::EncodeBc1(pixels.data(), width, height, nullptr, &serialBlocks);
+		TaskPool taskPool;
+		BlockCompression::EncodeBc1(pixels.data(), width, height, &taskPool, &parallelBlocks);
+		CHECK(serialBlocks == parallelBlocks);
+	}
+}
@@ -0,0 +1,96 @@
+#include "stdafx.h"
+#include "PixelFormat.h"
+#include "TaskPool.h"
+#include "Tests.h"
+#include <cfloat>
+
+// Decodes to premultiplied BGRA the way VaporPlus::DecodeImage does, with its own WIC factory so several can run
+// at once. Returns false if the file can't be opened.
+static bool DecodeToBgra8(std::wstring const& filename, std::vector<UINT>* pixels)
+{
+	ComPtr<IWICImagingFactory> wicImagingFactory;
+	ThrowIfFailed(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&wicImagingFactory)));
+
+	ComPtr<IWICBitmapDecoder> decoder;
+	if (FAILED(wicImagingFactory->CreateDecoderFromFilename(filename.c_str(), nullptr, GENERIC_READ, WICDecodeMetadataCacheOnLoad, &decoder)))
+		return false;
+
+	ComPtr<IWICBitmapFrameDecode> frame;
+	ThrowIfFailed(decoder->GetFrame(0, &frame));
+
+	UINT width, height;
+	WICPixelFormatGUID wicFormat;
+	ThrowIfFailed(frame->GetSize(&width, &height));
+	ThrowIfFailed(frame->GetPixelFormat(&wicFormat));
+	pixels->resize(width * height);
+
+	PixelFormat::Source sourceFormat;
+	if (PixelFormat::FromWicFormat(wicFormat, &sourceFormat))
+	{
+		UINT sourcePitch = PixelFormat::GetBytesPerPixel(sourceFormat) * width;
+		std::vector<BYTE> sourcePixels(sourcePitch * height);
+		ThrowIfFailed(frame->CopyPixels(nullptr, sourcePitch, static_cast<UINT>(sourcePixels.size()), sourcePixels.data()));
+		PixelFormat::ConvertToPremultipliedBgra8(sourceFormat, sourcePixels.data(), pixels->data(), pixels->size());
+	}
+	else
+	{
+		ComPtr<IWICFormatConverter> converter;
+		ThrowIfFailed(wicImagingFactory->CreateFormatConverter(&converter));
+		ThrowIfFailed(converter->Initialize(frame.Get(), GUID_WICPixelFormat32bppPBGRA, WICBitmapDitherTypeNone, nullptr, 0.0f, WICBitmapPaletteTypeMedianCut));
+		ThrowIfFailed(converter->CopyPixels(nullptr, width * 4, width * height * 4, reinterpret_cast<BYTE*>(pixels->data())));
+	}
+	return true;
+}
+
+// The app's three textures decoded one after another, then all at once on the task pool as LoadTextures does.
+void Tests::RunDecodeBenchmarks(std::wstring const& imageDirectory)
+{
+	std::wstring filenames[] =
+	{
+		imageDirectory + L"checker.png",
+		imageDirectory + L"Cityscape.png",
+		imageDirectory + L"TVNoise.png",
+	};
+	std::vector<UINT> pixels[_countof(filenames)];
+
+	for (size_t i = 0; i < _countof(filenames); ++i)
+	{
+		if (!DecodeToBgra8(filenames[i], &pixels[i]))
+		{
+			printf("Skipping the decode benchmarks: can't open %ls\n", filenames[i].c_str());
+			return;
+		}
+	}
+
+	double bestSerialMs = DBL_MAX;
+	double bestParallelMs = DBL_MAX;
+	TaskPool taskPool;
+	for (int run = 0; run < 3; ++run)
+	{
+		LARGE_INTEGER start;
+		QueryPerformanceCounter(&start);
+		for (size_t i = 0; i < _countof(filenames); ++i)
+		{
+			DecodeToBgra8(filenames[i], &pixels[i]);
+		}
+		bestSerialMs = min(bestSerialMs, GetElapsedMs(start));
+
+		QueryPerformanceCounter(&start);
+		TaskPool::TaskGroup group;
+		for (size_t i = 0; i < _countof(filenames); ++i)
+		{
+			taskPool.Run(&group, [&filenames, &pixels, i]()
+			{
+				// Worker threads join the multithreaded apartment themselves.
+				ThrowIfFailed(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
+				DecodeToBgra8(filenames[i], &pixels[i]);
+				CoUninitialize();
+			});
+		}
+		taskPool.Wait(&group);
+		bestParallelMs = min(bestParallelMs, GetElapsedMs(start));
+	}
+
+	printf("Decoding %zu textures: %.2f ms one at a time, %.2f ms on %u threads, %.2fx\n",
+		_countof(filenames), bestSerialMs, bestParallelMs, taskPool.GetThreadCount(), bestSerialMs / bestParallelMs);
+}
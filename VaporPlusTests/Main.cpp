@@ -0,0 +1,62 @@
+#include "stdafx.h"
+#include "Tests.h"
+
+static UINT s_checkCount = 0;
+static UINT s_failureCount = 0;
+
+void Tests::Check(bool condition, char const* expression, char const* file, int line)
+{
+	++s_checkCount;
+	if (condition)
+		return;
+
+	// The exhaustive checks can fail thousands of times over, and the first few say enough.
+	if (s_failureCount < 20)
+	{
+		printf("%s(%d): check failed: %s\n", file, line, expression);
+	}
+	++s_failureCount;
+}
+
+double Tests::GetElapsedMs(LARGE_INTEGER start)
+{
+	LARGE_INTEGER end, frequency;
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+	return static_cast<double>(end.QuadPart - start.QuadPart) * 1000.0 / static_cast<double>(frequency.QuadPart);
+}
+
+// VaporPlusTests [image directory]
+// The decode benchmarks read the app's textures from the image directory, ..\VaporPlus\ by default, which is where
+// they are when run from Visual Studio.
+int wmain(int argc, wchar_t* argv[])
+{
+	std::wstring imageDirectory = argc > 1 ? argv[1] : L"..\\VaporPlus\\";
+	if (!imageDirectory.empty() && imageDirectory.back() != L'\\' && imageDirectory.back() != L'/')
+	{
+		imageDirectory += L'\\';
+	}
+
+	try
+	{
+		ThrowIfFailed(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
+
+		Tests::RunPixelFormatTests();
+		Tests::RunBlockCompressionTests();
+		Tests::RunTaskPoolTests();
+
+		Tests::RunPixelFormatBenchmarks();
+		Tests::RunTaskPoolBenchmarks();
+		Tests::RunDecodeBenchmarks(imageDirectory);
+
+		CoUninitialize();
+	}
+	catch (std::exception const& exception)
+	{
+		printf("Unexpected exception: %s\n", exception.what());
+		return 1;
+	}
+
+	printf("%u of %u checks failed\n", s_failureCount, s_checkCount);
+	return s_failureCount == 0 ? 0 : 1;
+}
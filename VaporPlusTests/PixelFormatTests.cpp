@@ -0,0 +1,253 @@
+#include "stdafx.h"
+#include "PixelFormat.h"
+#include "Tests.h"
+#include <cfloat>
+#include <random>
+
+using PixelFormat::InstructionSet;
+using PixelFormat::Source;
+
+static const Source s_sources[] =
+{
+	Source::Gray8,
+	Source::Rgb8,
+	Source::Bgr8,
+	Source::Rgba8,
+	Source::Bgra8,
+	Source::PremultipliedRgba8,
+	Source::PremultipliedBgra8,
+};
+
+static char const* GetName(InstructionSet instructionSet)
+{
+	switch (instructionSet)
+	{
+	case InstructionSet::Scalar: return "scalar";
+	case InstructionSet::Sse2: return "SSE2";
+	case InstructionSet::Ssse3: return "SSSE3";
+	case InstructionSet::Avx2: return "AVX2";
+	}
+	return "?";
+}
+
+static char const* GetName(Source source)
+{
+	switch (source)
+	{
+	case Source::Gray8: return "Gray8";
+	case Source::Rgb8: return "Rgb8";
+	case Source::Bgr8: return "Bgr8";
+	case Source::Rgba8: return "Rgba8";
+	case Source::Bgra8: return "Bgra8";
+	case Source::PremultipliedRgba8: return "PremultipliedRgba8";
+	case Source::PremultipliedBgra8: return "PremultipliedBgra8";
+	}
+	return "?";
+}
+
+// Every instruction set up to what this CPU supports, the scalar loop first.
+static std::vector<InstructionSet> GetTestedInstructionSets()
+{
+	std::vector<InstructionSet> instructionSets;
+	for (InstructionSet instructionSet : { InstructionSet::Scalar, InstructionSet::Sse2, InstructionSet::Ssse3, InstructionSet::Avx2 })
+	{
+		if (instructionSet <= PixelFormat::GetSupportedInstructionSet())
+		{
+			instructionSets.push_back(instructionSet);
+		}
+	}
+	return instructionSets;
+}
+
+// round(color * alpha / 255) by plain division. color * alpha / 255 is never exactly halfway between integers.
+static UINT ReferenceMultiply(UINT color, UINT alpha)
+{
+	return (color * alpha * 2 + 255) / 510;
+}
+
+static UINT PackBgra(UINT b, UINT g, UINT r, UINT a)
+{
+	return b | (g << 8) | (r << 16) | (a << 24);
+}
+
+static UINT ReferenceConvert(Source source, BYTE const* pixel)
+{
+	switch (source)
+	{
+	case Source::Gray8:
+		return PackBgra(pixel[0], pixel[0], pixel[0], 255);
+	case Source::Rgb8:
+		return PackBgra(pixel[2], pixel[1], pixel[0], 255);
+	case Source::Bgr8:
+		return PackBgra(pixel[0], pixel[1], pixel[2], 255);
+	case Source::Rgba8:
+		return PackBgra(ReferenceMultiply(pixel[2], pixel[3]), ReferenceMultiply(pixel[1], pixel[3]), ReferenceMultiply(pixel[0], pixel[3]), pixel[3]);
+	case Source::Bgra8:
+		return PackBgra(ReferenceMultiply(pixel[0], pixel[3]), ReferenceMultiply(pixel[1], pixel[3]), ReferenceMultiply(pixel[2], pixel[3]), pixel[3]);
+	case Source::PremultipliedRgba8:
+		return PackBgra(pixel[2], pixel[1], pixel[0], pixel[3]);
+	case Source::PremultipliedBgra8:
+		return PackBgra(pixel[0], pixel[1], pixel[2], pixel[3]);
+	}
+	return 0;
+}
+
+// Pixel i has alpha i / 256, and its color channels are i % 256 through three different permutations, so with
+// 65536 pixels each channel meets every (color, alpha) pair.
+static std::vector<BYTE> MakeSourcePixels(Source source, size_t pixelCount)
+{
+	UINT bytesPerPixel = PixelFormat::GetBytesPerPixel(source);
+	std::vector<BYTE> bytes(pixelCount * bytesPerPixel);
+	for (size_t i = 0; i < pixelCount; ++i)
+	{
+		BYTE color = static_cast<BYTE>(i);
+		BYTE* pixel = &bytes[i * bytesPerPixel];
+		pixel[0] = color;
+		if (bytesPerPixel >= 3)
+		{
+			pixel[1] = static_cast<BYTE>(color ^ 0x5A);
+			pixel[2] = static_cast<BYTE>(255 - color);
+		}
+		if (bytesPerPixel == 4)
+		{
+			pixel[3] = static_cast<BYTE>(i >> 8);
+		}
+	}
+	return bytes;
+}
+
+static UINT CountConversionMismatches(Source source, std::vector<BYTE> const& sourcePixels, size_t pixelCount)
+{
+	std::vector<UINT> converted(pixelCount + 1, 0xDEADBEEF);
+	PixelFormat::ConvertToPremultipliedBgra8(source, sourcePixels.data(), converted.data(), pixelCount);
+
+	UINT bytesPerPixel = PixelFormat::GetBytesPerPixel(source);
+	UINT mismatches = 0;
+	for (size_t i = 0; i < pixelCount; ++i)
+	{
+		if (converted[i] != ReferenceConvert(source, &sourcePixels[i * bytesPerPixel]))
+		{
+			++mismatches;
+		}
+	}
+
+	// Nothing past the end may be written.
+	if (converted[pixelCount] != 0xDEADBEEF)
+	{
+		++mismatches;
+	}
+	return mismatches;
+}
+
+static void TestConversions(InstructionSet instructionSet)
+{
+	for (Source source : s_sources)
+	{
+		// Every (color, alpha) pair, then a few more so each vector loop leaves a tail for the scalar one.
+		std::vector<BYTE> sourcePixels = MakeSourcePixels(source, 256 * 256 + 13);
+		UINT mismatches = CountConversionMismatches(source, sourcePixels, sourcePixels.size() / PixelFormat::GetBytesPerPixel(source));
+
+		// Every count up to a few vectors' worth, for where each loop stops.
+		for (size_t pixelCount = 0; pixelCount <= 40; ++pixelCount)
+		{
+			mismatches += CountConversionMismatches(source, sourcePixels, pixelCount);
+		}
+
+		if (mismatches != 0)
+		{
+			printf("%s conversion from %s: %u mismatches\n", GetName(instructionSet), GetName(source), mismatches);
+		}
+		CHECK(mismatches == 0);
+	}
+}
+
+static void ReferenceDownsample(UINT const* sourcePixels, UINT sourceWidth, UINT sourceHeight, UINT* destinationPixels)
+{
+	UINT destinationWidth = max(sourceWidth / 2, 1u);
+	UINT destinationHeight = max(sourceHeight / 2, 1u);
+	for (UINT y = 0; y < destinationHeight; ++y)
+	{
+		for (UINT x = 0; x < destinationWidth; ++x)
+		{
+			UINT x0 = min(x * 2, sourceWidth - 1), x1 = min(x * 2 + 1, sourceWidth - 1);
+			UINT y0 = min(y * 2, sourceHeight - 1), y1 = min(y * 2 + 1, sourceHeight - 1);
+			UINT pixel = 0;
+			for (UINT shift = 0; shift < 32; shift += 8)
+			{
+				UINT sum =
+					((sourcePixels[y0 * sourceWidth + x0] >> shift) & 0xFF) + ((sourcePixels[y0 * sourceWidth + x1] >> shift) & 0xFF) +
+					((sourcePixels[y1 * sourceWidth + x0] >> shift) & 0xFF) + ((sourcePixels[y1 * sourceWidth + x1] >> shift) & 0xFF);
+				pixel |= ((sum + 2) / 4) << shift;
+			}
+			destinationPixels[y * destinationWidth + x] = pixel;
+		}
+	}
+}
+
+static void TestDownsample(InstructionSet instructionSet)
+{
+	static const UINT sizes[][2] = { { 1, 1 }, { 2, 2 }, { 3, 3 }, { 7, 5 }, { 16, 1 }, { 1, 16 }, { 17, 2 }, { 33, 17 }, { 256, 256 } };
+
+	std::mt19937 random(42);
+	for (auto const& size : sizes)
+	{
+		UINT width = size[0], height = size[1];
+		std::vector<UINT> source(width * height);
+		for (UINT& pixel : source)
+		{
+			pixel = random();
+		}
+
+		size_t destinationCount = max(width / 2, 1u) * max(height / 2, 1u);
+		std::vector<UINT> expected(destinationCount), downsampled(destinationCount);
+		ReferenceDownsample(source.data(), width, height, expected.data());
+		PixelFormat::DownsampleBgra8(source.data(), width, height, downsampled.data());
+
+		if (downsampled != expected)
+		{
+			printf("%s downsample of %ux%u differs\n", GetName(instructionSet), width, height);
+		}
+		CHECK(downsampled == expected);
+	}
+}
+
+void Tests::RunPixelFormatTests()
+{
+	printf("Pixel format conversion, instruction sets up to %s\n", GetName(PixelFormat::GetSupportedInstructionSet()));
+
+	for (InstructionSet instructionSet : GetTestedInstructionSets())
+	{
+		PixelFormat::SetInstructionSet(instructionSet);
+		TestConversions(instructionSet);
+		TestDownsample(instructionSet);
+	}
+	PixelFormat::SetInstructionSet(PixelFormat::GetSupportedInstructionSet());
+
+	CHECK(PixelFormat::GetMipLevelCount(1, 1) == 1);
+	CHECK(PixelFormat::GetMipLevelCount(256, 256) == 9);
+	CHECK(PixelFormat::GetMipLevelCount(300, 7) == 9);
+}
+
+void Tests::RunPixelFormatBenchmarks()
+{
+	const size_t pixelCount = 4096 * 4096;
+	std::vector<BYTE> sourcePixels = MakeSourcePixels(Source::Rgba8, pixelCount);
+	std::vector<UINT> converted(pixelCount);
+
+	printf("Premultiplying %zu RGBA pixels:\n", pixelCount);
+	for (InstructionSet instructionSet : GetTestedInstructionSets())
+	{
+		PixelFormat::SetInstructionSet(instructionSet);
+
+		double bestMs = DBL_MAX;
+		for (int run = 0; run < 3; ++run)
+		{
+			LARGE_INTEGER start;
+			QueryPerformanceCounter(&start);
+			PixelFormat::ConvertToPremultipliedBgra8(Source::Rgba8, sourcePixels.data(), converted.data(), pixelCount);
+			bestMs = min(bestMs, GetElapsedMs(start));
+		}
+		printf("  %-6s %7.2f ms, %5.2f GB/s\n", GetName(instructionSet), bestMs, pixelCount * 4 / (bestMs * 1e6));
+	}
+	PixelFormat::SetInstructionSet(PixelFormat::GetSupportedInstructionSet());
+}
@@ -0,0 +1,176 @@
+#include "stdafx.h"
+#include "TaskPool.h"
+#include "Tests.h"
+#include <cfloat>
+#include <cmath>
+
+// Every index is visited exactly once, whatever the range and grain size.
+static void TestParallelForCoverage(TaskPool& taskPool)
+{
+	for (UINT count : { 0u, 1u, 1000u, 100003u })
+	{
+		for (UINT grainSize : { 0u, 1u, 7u, 1024u, 1000000u })
+		{
+			std::vector<UINT> visits(count + 10, 0);
+			taskPool.ParallelFor(10, count + 10, grainSize, [&](UINT begin, UINT end)
+			{
+				for (UINT i = begin; i < end; ++i)
+				{
+					++visits[i];
+				}
+			});
+
+			bool eachOnce = true;
+			for (UINT i = 0; i < visits.size(); ++i)
+			{
+				eachOnce = eachOnce && visits[i] == (i >= 10 ? 1u : 0u);
+			}
+			CHECK(eachOnce);
+		}
+	}
+}
+
+// Tasks that spawn and wait on groups of their own.
+static void TestNestedGroups(TaskPool& taskPool)
+{
+	std::atomic<UINT> leafCount{ 0 };
+	TaskPool::TaskGroup outerGroup;
+	for (int i = 0; i < 64; ++i)
+	{
+		taskPool.Run(&outerGroup, [&]()
+		{
+			TaskPool::TaskGroup innerGroup;
+			for (int j = 0; j < 64; ++j)
+			{
+				taskPool.Run(&innerGroup, [&]() { leafCount.fetch_add(1); });
+			}
+			taskPool.Wait(&innerGroup);
+		});
+	}
+	taskPool.Wait(&outerGroup);
+	CHECK(leafCount.load() == 64 * 64);
+}
+
+// Wait rethrows the first exception after every task of the group has finished, and the pool keeps working.
+static void TestExceptions(TaskPool& taskPool)
+{
+	std::atomic<UINT> finishedCount{ 0 };
+	TaskPool::TaskGroup group;
+	for (int i = 0; i < 100; ++i)
+	{
+		taskPool.Run(&group, [&finishedCount, i]()
+		{
+			if (i % 10 == 3)
+				throw std::runtime_error("task failed");
+			finishedCount.fetch_add(1);
+		});
+	}
+
+	bool caught = false;
+	try
+	{
+		taskPool.Wait(&group);
+	}
+	catch (std::runtime_error const&)
+	{
+		caught = true;
+	}
+	CHECK(caught);
+	CHECK(finishedCount.load() == 90);
+
+	TaskPool::TaskGroup laterGroup;
+	taskPool.Run(&laterGroup, [&finishedCount]() { finishedCount.fetch_add(1); });
+	taskPool.Wait(&laterGroup);
+	CHECK(finishedCount.load() == 91);
+}
+
+void Tests::RunTaskPoolTests()
+{
+	printf("Task pool\n");
+
+	// With no worker threads, and with the default of one per hardware thread.
+	for (UINT workerThreadCount : { 0u, UINT_MAX })
+	{
+		TaskPool taskPool(workerThreadCount);
+		CHECK(taskPool.GetThreadCount() == (workerThreadCount == 0 ? 1u : max(std::thread::hardware_concurrency(), 2u)));
+		TestParallelForCoverage(taskPool);
+		TestNestedGroups(taskPool);
+		TestExceptions(taskPool);
+	}
+}
+
+// Enough arithmetic per item that memory bandwidth doesn't cap the scaling.
+static float ComputeItem(UINT i)
+{
+	float value = static_cast<float>(i);
+	for (int step = 0; step < 64; ++step)
+	{
+		value = sqrtf(value * 1.0001f + static_cast<float>(step));
+	}
+	return value;
+}
+
+void Tests::RunTaskPoolBenchmarks()
+{
+	// The cost of spawning and running a task, with nothing to do in it.
+	{
+		TaskPool taskPool;
+		const UINT taskCount = 100000;
+
+		LARGE_INTEGER start;
+		QueryPerformanceCounter(&start);
+		TaskPool::TaskGroup group;
+		for (UINT i = 0; i < taskCount; ++i)
+		{
+			taskPool.Run(&group, []() {});
+		}
+		taskPool.Wait(&group);
+		double runMs = GetElapsedMs(start);
+
+		QueryPerformanceCounter(&start);
+		taskPool.ParallelFor(0, taskCount, 1, [](UINT, UINT) {});
+		double parallelForMs = GetElapsedMs(start);
+
+		TaskPool::Stats stats = taskPool.GetStats();
+		printf("Task overhead on %u threads: %.0f ns per Run, %.0f ns per ParallelFor chunk, %llu steals\n",
+			taskPool.GetThreadCount(), runMs * 1e6 / taskCount, parallelForMs * 1e6 / taskCount, stats.Steals);
+	}
+
+	// The same compute-bound ParallelFor on more and more threads.
+	{
+		const UINT itemCount = 1 << 20;
+		std::vector<float> results(itemCount);
+		UINT hardwareThreadCount = max(std::thread::hardware_concurrency(), 1u);
+
+		printf("ParallelFor scaling over %u items:\n", itemCount);
+		double singleThreadMs = 0.0;
+		for (UINT threadCount = 1; ; threadCount = min(threadCount * 2, hardwareThreadCount))
+		{
+			TaskPool taskPool(threadCount - 1);
+
+			double bestMs = DBL_MAX;
+			for (int run = 0; run < 3; ++run)
+			{
+				LARGE_INTEGER start;
+				QueryPerformanceCounter(&start);
+				taskPool.ParallelFor(0, itemCount, 4096, [&](UINT begin, UINT end)
+				{
+					for (UINT i = begin; i < end; ++i)
+					{
+						results[i] = ComputeItem(i);
+					}
+				});
+				bestMs = min(bestMs, GetElapsedMs(start));
+			}
+
+			if (threadCount == 1)
+			{
+				singleThreadMs = bestMs;
+			}
+			printf("  %3u threads: %8.2f ms, %5.2fx\n", threadCount, bestMs, singleThreadMs / bestMs);
+
+			if (threadCount == hardwareThreadCount)
+				break;
+		}
+	}
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+// A minimal test runner. Checks count and report failures without stopping the run, and benchmarks only print
+// their timings.
+namespace Tests
+{
+	void Check(bool condition, char const* expression, char const* file, int line);
+	double GetElapsedMs(LARGE_INTEGER start);
+
+	void RunPixelFormatTests();
+	void RunPixelFormatBenchmarks();
+	void RunBlockCompressionTests();
+	void RunTaskPoolTests();
+	void RunTaskPoolBenchmarks();
+	void RunDecodeBenchmarks(std::wstring const& imageDirectory);
+}
+
+#define CHECK(condition) Tests::Check((condition), #condition, __FILE__, __LINE__)